@@ -25,39 +25,48 @@
 #include "ext_obex.h"			// required for new style Max object
 #include "z_dsp.h"				//	for sys_getsr(), t_double, t_float, t_vptr
 #include "ext_strings.h"
+#include "ext_dictobj.h"		//	sweep results
+#include "ext_buffer.h"			//	response curves
 
 #include <math.h>
 
-#ifndef	pi
-#define	pi		3.1415926535897932384626433
-#endif
+#include "cheb_design.h"		//	pole/ripple/cutoff design math shared with the command line tools
+#include "cheb_atlas.h"			//	precomputed designs
+#include "iir_multirate.h"		//	decimation limits shared with iir~
 
-//	double	T	= 2.0 * tan(0.5);
-#define	T		1.0926049796875809683172064978862181305885
-//	double	TT	= T * T;
-#define	TT		1.1937856416380991930736854556016623973846
+#define CHEB_MAX_SWEEP	16384
 
-#define MAX_CHEB_POLES	20
+//	log spaced response bins start here
+#define CHEB_RESPONSE_LOW_HZ	20.0
+//	floor for response magnitudes
+#define CHEB_RESPONSE_MIN_DB	-300.0
 
 typedef struct _cheb
 {
 	t_object	p_ob;		// object header - ALL objects MUST begin with this...
 	t_double	omegah;
+	t_double	cutoff;		//	Hz, as last set
+	long		decimate;	//	design for an iir~ running at 1/decimate of the sample rate
 	t_uint8		lowHIGH;
 	t_uint8		poles;
-	t_double	piPoles;
-	t_double	piPoles2;
 	t_double	ripple;
-	t_double	sinhVXoKX;
-	t_double	coshVXoKX;
+	t_chebstages stages;	//	cached intermediate design results
 	t_double	*a;
 	t_double	*b;
 	t_uint8		outOrder;	//	0 = abab, 1 = aabb
 	t_vptr		outlet;		//	list outlet
+	t_vptr		dictOutlet;	//	sweep and response results
+	t_dictionary *sweepDict;
+	t_symbol	*sweepName;
 } t_cheb;
 
 void *cheb_class;
 
+//	atlas shared by every instance, NULL when none is loaded; replaced atlases stay mapped because
+//	an instance on the scheduler thread may still be reading one
+static t_chebatlas *cheb_atlas = NULL;
+static t_symbol *cheb_atlasName = NULL;
+
 //// standard set
 void *cheb_new(t_symbol *s, long argc, t_atom *argv);
 void cheb_free(t_cheb *x);
@@ -73,8 +82,13 @@ void cheb_cutoff(t_cheb *x, double c);
 void cheb_cutoffInt(t_cheb *x, long l);
 void cheb_poles(t_cheb *x, long p);
 void cheb_ripple(t_cheb *x, double r);
+void cheb_sweep(t_cheb *x, t_symbol *s, long argc, t_atom *argv);
+void cheb_response(t_cheb *x, t_symbol *s, long argc, t_atom *argv);
+void cheb_atlasMsg(t_cheb *x, t_symbol *s, long argc, t_atom *argv);
+void cheb_decimate(t_cheb *x, long factor);
+double cheb_samplerate(t_cheb *x);
+const char *cheb_atlas_load(const char *name);
 
-void cheb_rippleCalc(t_cheb *x);
 void cheb_calculate(t_cheb *x);
 void cheb_getPointers(t_cheb *x);
 void cheb_releasePtrs(t_cheb *x);
@@ -97,9 +111,16 @@ int C74_EXPORT main(void)
 	class_addmethod(c, (method)cheb_cutoffInt, "int", A_LONG, 0); 	// the method for a integer in the left inlet (inlet 0)
 	class_addmethod(c, (method)cheb_poles, "in1", A_DEFLONG, 0);
 	class_addmethod(c, (method)cheb_ripple, "ft2", A_DEFFLOAT, 0);  
+	class_addmethod(c, (method)cheb_sweep, "sweep", A_GIMME, 0);
+	class_addmethod(c, (method)cheb_response, "response", A_GIMME, 0);
+	class_addmethod(c, (method)cheb_atlasMsg, "atlas", A_GIMME, 0);
+	class_addmethod(c, (method)cheb_decimate, "decimate", A_LONG, 0);
 	
 	class_register(CLASS_BOX, c);
 	cheb_class = c;
+	
+	//	use cheb.atlas if there is one in the search path
+	cheb_atlas_load("cheb.atlas");
 
 //	post("cheb object loaded...",0);
 	return 0;
@@ -120,8 +141,12 @@ void *cheb_new(t_symbol *s, long argc, t_atom *argv)
 		floatin(x, 2);	//	ripple
 		intin(x, 1);	//	poles
 	
-		//	create list outlet
+		//	create outlets, RIGHT TO LEFT
+		x->dictOutlet = outlet_new(x, NULL);	//	untyped: dictionaries from sweep, lists from response
 		x->outlet = listout(x);
+		
+		x->sweepDict = NULL;
+		x->sweepName = NULL;
 	
 		//	post message
 		post("cheb [low|high] [#poles] [(float)%%ripple] [aabab|aaabb]");
@@ -140,10 +165,8 @@ void *cheb_new(t_symbol *s, long argc, t_atom *argv)
 			p = atom_getlong(argv+1);
 			
 			//	floor() to the lower even number (ignore last bit)
-			x->poles = ( p > MAX_CHEB_POLES ? MAX_CHEB_POLES : (p < 0 ? 0 : p ) ) & 0xFFFFFFFE;
+			x->poles = cheb_limit_poles(p);
 		}
-		x->piPoles	= pi/x->poles;
-		x->piPoles2	= pi/(x->poles*2.0);
 	
 		//	start with result pointers == zero
 		x->a = x->b = 0L;
@@ -161,7 +184,9 @@ void *cheb_new(t_symbol *s, long argc, t_atom *argv)
 				x->ripple = r;
 			}
 		}
-		cheb_rippleCalc(x);
+		
+		//	nothing designed yet
+		cheb_stages_init(&x->stages);
 	
 		//	output order
 		if( argc > 3 && !strcmp(atom_getsym(argv+3)->s_name, "aaabb") )
@@ -171,6 +196,8 @@ void *cheb_new(t_symbol *s, long argc, t_atom *argv)
 	
 		//	set default values
 		x->omegah		= 0.03926990816987241;	//	aprox 1100Hz at 44.1kHz
+		x->decimate		= 1;
+		x->cutoff		= x->omegah / pi * sys_getsr();
 	
 		cheb_calculate(x);
 	}
@@ -181,6 +208,9 @@ void *cheb_new(t_symbol *s, long argc, t_atom *argv)
 void cheb_free(t_cheb *x)
 {
 	cheb_releasePtrs(x);
+	
+	if (x->sweepDict)
+		object_free(x->sweepDict);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -188,7 +218,10 @@ void cheb_assist(t_cheb *x, void *b, long m, long a, char *s)
 {
 	if (m == ASSIST_OUTLET)
 	{
-		sprintf(s,"Coefficient output (list).");
+		if (a == 0)
+			sprintf(s,"Coefficient output (list).");
+		else
+			sprintf(s,"Sweep output (dictionary), response output (lists).");
 	}
 	else
 	{
@@ -290,11 +323,9 @@ void cheb_cutoffInt(t_cheb *x, long l)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void cheb_cutoff(t_cheb *x, double c)
 {
-	//	change to fraction of the sample rate
-	c	/=	sys_getsr();
-	
-	//	check the range and mulitply by pi (not 2¹); omegah contains true omega/2 (omega-half)
-	x->omegah	= ( c > 0.5 ? 0.5 : (c < 0.0 ? 0.0 : c) ) * pi;
+	//	change to fraction of the sample rate, check the range and mulitply by pi
+	x->cutoff	= c;
+	x->omegah	= cheb_omegah(c, cheb_samplerate(x));
 	
 // 	post("Fc = %g, LH = %d", x->omegah/pi, x->lowHIGH);
 	
@@ -305,9 +336,8 @@ void cheb_cutoff(t_cheb *x, double c)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void cheb_ripple(t_cheb *x, double r)
 {
-	x->ripple = (r>29.0) ? 29.0 : ((r<0.0) ? 0.0 : r);
+	x->ripple = cheb_limit_ripple(r);
 	
-	cheb_rippleCalc(x);
 	cheb_calculate(x);
 	cheb_bang(x);
 }
@@ -315,172 +345,318 @@ void cheb_ripple(t_cheb *x, double r)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void cheb_poles(t_cheb *x, long p)
 {
-	p = ( (p > MAX_CHEB_POLES) ? MAX_CHEB_POLES : ((p < 0) ? 0 : p ) ) & 0xFFFFFFFE;
+	p = cheb_limit_poles(p);
 	
 	cheb_releasePtrs(x);	//	count of a and b values may change
 
 	x->poles	= p;
-	x->piPoles	= pi/p;
-	x->piPoles2	= pi/(p*2.0);
 	
 	cheb_getPointers	(x);
 	
-	cheb_rippleCalc(x);
 	cheb_calculate(x);
 	cheb_bang(x);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////////
-void cheb_rippleCalc(t_cheb *x)
+//	sweep <f_start> <f_end> <count> [lin|log]
+//	Designs count coefficient sets with cutoffs from f_start to f_end (Hz) using the current type,
+//	poles and ripple, and sends them out the right outlet as a dictionary:
+//		cutoffs	count frequencies in Hz
+//		coeffs	count lists of poles*2+1 coefficients, one after the other, in the current output order
+void cheb_sweep(t_cheb *x, t_symbol *s, long argc, t_atom *argv)
 {
-	double	ESinv, VX, KX;
+	double	fStart, fEnd, sr, c, *omegah, *a, *b;
+	long	count, n, p, stride, useLog = 0;
+	t_atom	*cutoffs, *coeffs, *list, out;
 	
-	if ( x->ripple > 0.0 )
+	if ( argc < 3 )
 	{
-		ESinv	= 1.0 / sqrt( pow(100.0/(100.0 - (double)x->ripple), 2.0) - 1.0 );
-		VX		= asinh(ESinv) / (double)x->poles;
-		KX		= cosh( acosh(ESinv) / (double)x->poles );
-		
-		x->sinhVXoKX	= sinh(VX) / KX;
-		x->coshVXoKX	= cosh(VX) / KX;
+		object_error((t_object *)x, "sweep <f_start> <f_end> <count> [lin|log]");
+		return;
 	}
-	else
+	fStart	= atom_getfloat(argv);
+	fEnd	= atom_getfloat(argv+1);
+	count	= atom_getlong(argv+2);
+	if ( argc > 3 && atom_getsym(argv+3) == gensym("log") )
+		useLog = 1;
+	
+	if ( count < 1 || count > CHEB_MAX_SWEEP || x->poles < 2 || (useLog && (fStart <= 0.0 || fEnd <= 0.0)) )
 	{
-		x->sinhVXoKX	= 0.0;
-		x->coshVXoKX	= 0.0;
+		object_error((t_object *)x, "sweep: count must be 1-%d, poles at least 2, and log frequencies above 0", CHEB_MAX_SWEEP);
+		return;
 	}
 	
-// 	post("ES = %g, VX = %g, KX = %g", 1/ESinv, VX, KX);
+	sr		= cheb_samplerate(x);
+	stride	= x->poles + 1;
+	omegah	= (double *)sysmem_newptr(count * sizeof(double));
+	a		= (double *)sysmem_newptr((count * stride + 2) * sizeof(double));	//	at least CHEB_WORK_SIZE
+	b		= (double *)sysmem_newptr((count * stride + 2) * sizeof(double));
+	cutoffs	= (t_atom *)sysmem_newptr(count * sizeof(t_atom));
+	coeffs	= (t_atom *)sysmem_newptr(count * (x->poles*2+1) * sizeof(t_atom));
+	
+	if ( omegah && a && b && cutoffs && coeffs )
+	{
+		for ( n=0; n < count; n++ )
+		{
+			if ( count == 1 )
+				c = fStart;
+			else if ( useLog )
+				c = fStart * pow(fEnd / fStart, (double)n / (count-1));
+			else
+				c = fStart + (fEnd - fStart) * n / (count-1);
+			
+			atom_setfloat(cutoffs+n, c);
+			
+			//	same range check as cheb_cutoff()
+			omegah[n] = cheb_omegah(c, sr);
+		}
+		
+		//	make sure the pole and ripple stages are current, then run every cutoff at once;
+		//	cheb_calculate() may have found its design in the atlas and left them alone
+		cheb_stages_design(&x->stages, a, b, x->poles, x->omegah, x->lowHIGH, x->ripple);
+		cheb_stage_cutoff_sweep(&x->stages, a, b, omegah, count, x->lowHIGH);
+		
+		for ( n=0; n < count; n++ )
+		{
+			list = coeffs + n*(x->poles*2+1);
+			atom_setfloat(list, a[n*stride]);
+			for ( p=1; p<=x->poles; p++ )
+			{
+				if (x->outOrder)
+				{
+					atom_setfloat(list+(p), a[n*stride+p]);
+					atom_setfloat(list+(x->poles+p), b[n*stride+p]);
+				}
+				else
+				{
+					atom_setfloat(list+(2*p-1), a[n*stride+p]);
+					atom_setfloat(list+(2*p), b[n*stride+p]);
+				}
+			}
+		}
+		
+		if ( !x->sweepDict )
+			x->sweepDict = dictobj_register(dictionary_new(), &x->sweepName);
+		
+		if ( x->sweepDict )
+		{
+			dictionary_clear(x->sweepDict);
+			dictionary_appendsym(x->sweepDict, gensym("type"), gensym(x->lowHIGH ? "high" : "low"));
+			dictionary_appendlong(x->sweepDict, gensym("poles"), x->poles);
+			dictionary_appendfloat(x->sweepDict, gensym("ripple"), x->ripple);
+			dictionary_appendsym(x->sweepDict, gensym("order"), gensym(x->outOrder ? "aaabb" : "aabab"));
+			dictionary_appendatoms(x->sweepDict, gensym("cutoffs"), count, cutoffs);
+			dictionary_appendatoms(x->sweepDict, gensym("coeffs"), count * (x->poles*2+1), coeffs);
+			
+			atom_setsym(&out, x->sweepName);
+			outlet_anything(x->dictOutlet, gensym("dictionary"), 1, &out);
+		}
+	}
+	else
+		object_error((t_object *)x, "sweep: out of memory");
+	
+	if (omegah) sysmem_freeptr(omegah);
+	if (a) sysmem_freeptr(a);
+	if (b) sysmem_freeptr(b);
+	if (cutoffs) sysmem_freeptr(cutoffs);
+	if (coeffs) sysmem_freeptr(coeffs);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void cheb_calculate(t_cheb *x)
+//	response <bins> [lin|log] [buffer <name>]
+//	Evaluates the frequency response of the current design at bins frequencies from 0 Hz (20 Hz for
+//	log) to Nyquist, at the rate the design is for (see decimate), and sends these out the right outlet:
+//		frequencies	bins frequencies in Hz
+//		magnitude	bins magnitudes in dB
+//		phase		bins phases in radians, -pi to pi
+//	With buffer <name>, the magnitudes are written to its first channel and the phases to its second
+//	instead, as many as fit.
+void cheb_response(t_cheb *x, t_symbol *s, long argc, t_atom *argv)
 {
-	// holds the "a" & "b" coefficients upon program completion
-	//double	a[numCoeffs], b[numCoeffs];
-	// internal use for combining stages
-	//double	ta[numCoeffs], tb[numCoeffs];
-	double	*ta	= (double *)sysmem_newptr((x->poles+3) * sizeof(double));
-	double	*tb	= (double *)sysmem_newptr((x->poles+3) * sizeof(double));
-	
-	double	K, KK;
-	double	RP, IP, M, D, X0, X1, X2, Y1, Y2;
-	double	A0, A1, A2, B1, B2, sa, sb, gain;
-	long 	p, i;
-	
-	// INITIALIZE VARIABLES
-	for ( i=0; i < x->poles+3; i++ )
+	double		sr, nyquist, *w, *mag, *phase;
+	long		bins, n, i, useLog = 0;
+	t_symbol	*bufName = NULL, *sym;
+	t_atom		*list;
+	
+	if ( argc < 1 || (bins = atom_getlong(argv)) < 2 || bins > CHEB_MAX_SWEEP )
 	{
-		x->a[i] = 0.0;
-		x->b[i] = 0.0;
+		object_error((t_object *)x, "response <bins 2-%d> [lin|log] [buffer <name>]", CHEB_MAX_SWEEP);
+		return;
+	}
+	for ( i=1; i < argc; i++ )
+	{
+		sym = atom_gettype(argv+i) == A_SYM ? atom_getsym(argv+i) : NULL;
+		if ( sym == gensym("log") )
+			useLog = 1;
+		else if ( sym == gensym("buffer") && i+1 < argc && atom_gettype(argv+i+1) == A_SYM )
+			bufName = atom_getsym(argv + ++i);
+		else if ( sym != gensym("lin") )
+		{
+			object_error((t_object *)x, "response <bins 2-%d> [lin|log] [buffer <name>]", CHEB_MAX_SWEEP);
+			return;
+		}
 	}
 	
-	x->a[2] = 1.0;
-	x->b[2] = 1.0;
-	
-	// LP TO LP, or LP TO HP transform	(new calculation not needed when ripple changes)
-	if ( x->lowHIGH )
-		K = -cos(x->omegah + 0.5) / cos(x->omegah - 0.5);
-	else
-		K =  sin(0.5 - x->omegah) / sin(0.5 + x->omegah);
-	
-	KK = K * K;
+	sr		= cheb_samplerate(x);
+	nyquist	= sr * 0.5;
+	w		= (double *)sysmem_newptr(bins * sizeof(double));
+	mag		= (double *)sysmem_newptr(bins * sizeof(double));
+	phase	= (double *)sysmem_newptr(bins * sizeof(double));
+	list	= (t_atom *)sysmem_newptr(bins * sizeof(t_atom));
 	
-	// LOOP FOR EACH POLE-PAIR
-	for ( p=1; p <= x->poles/2; p++ )
+	if ( w && mag && phase && list )
 	{
-		// cheb_calculate the pole location on the unit circle
-		RP = -cos(x->piPoles2 + (p-1) * x->piPoles);
-		IP =  sin(x->piPoles2 + (p-1) * x->piPoles);
-		
-		// Warp from a circle to an ellipse when ripple is greater than zero
-		if ( x->ripple > 0 )
+		for ( n=0; n < bins; n++ )
 		{
-			RP *= x->sinhVXoKX;
-			IP *= x->coshVXoKX;
+			if ( useLog && nyquist > CHEB_RESPONSE_LOW_HZ )
+				w[n] = CHEB_RESPONSE_LOW_HZ * pow(nyquist / CHEB_RESPONSE_LOW_HZ, (double)n / (bins-1));
+			else
+				w[n] = nyquist * n / (bins-1);
+			atom_setfloat(list+n, w[n]);
+			w[n] *= 2.0 * pi / sr;
 		}
 		
-// 		post("%d  RP = %g, IP = %g", p, RP, IP);
-		
-		// s-domain to z-domain conversion
-		M	= RP*RP + IP*IP;
-		D	= 4.0 - 4.0*RP*T + M*TT;
-		X0	= TT/D;
-		X1	= 2.0*X0;	//	X1	= 2.0*TT/D;
-		X2	= X0;		//	X2	= TT/D;
-		Y1	= (8.0 - 2.0*M*TT)/D;
-		Y2	= (-4.0 - 4.0*RP*T - M*TT)/D;
-		
-// 		post("%d  w = %g, M = %g, D = %g, X0 = %g, X1 = %g, X2 = %g, Y1 = %g, Y2 = %g", p, x->omegah*2, M, D, X0, X1, X2, Y1, Y2);
-		
-		D = 1 + Y1*K - Y2*KK;
+		//	the cached sections are the better conditioned of the two
+		if ( cheb_stages_current(&x->stages, x->poles, x->omegah, x->lowHIGH, x->ripple) )
+			cheb_response_sections(&x->stages, w, bins, mag, phase);
+		else
+			cheb_response_poly(x->a, x->b, x->poles, w, bins, mag, phase);
 		
-		A0	= (X0 - X1*K + X2*KK)/D;
-		A1	= (-2*X0*K + X1 + X1*KK - 2*X2*K)/D;
-		A2	= (X0*KK - X1*K + X2)/D;
-		B1	= (2*K + Y1 + Y1*KK - 2*Y2*K)/D;
-		B2	= (-KK - Y1*K + Y2)/D;
+		for ( n=0; n < bins; n++ )
+			mag[n] = mag[n] > 0.0 ? fmax(20.0 * log10(mag[n]), CHEB_RESPONSE_MIN_DB) : CHEB_RESPONSE_MIN_DB;
 		
-		if ( x->lowHIGH )
+		if ( bufName )
 		{
-			A1 = -A1;
-			B1 = -B1;
+			t_buffer_ref	*ref = buffer_ref_new((t_object *)x, bufName);
+			t_buffer_obj	*buf = buffer_ref_getobject(ref);
+			float			*samples;
+			
+			if ( buf && (samples = buffer_locksamples(buf)) )
+			{
+				long chans	= buffer_getchannelcount(buf);
+				long frames	= buffer_getframecount(buf);
+				
+				for ( n=0; n < bins && n < frames; n++ )
+				{
+					samples[n*chans] = (float)mag[n];
+					if ( chans > 1 )
+						samples[n*chans + 1] = (float)phase[n];
+				}
+				buffer_unlocksamples(buf);
+				buffer_setdirty(buf);
+			}
+			else
+				object_error((t_object *)x, "response: no buffer~ %s", bufName->s_name);
+			
+			object_free(ref);
 		}
-		
-// 		post("%d  A0 = %g, A1 = %g, A2 = %g, B1 = %g, B2 = %g", p, A0, A1, A2, B1, B2);
-		
-		// Add coefficients to the cascade
-		for ( i=0; i < x->poles+3; i++ )
+		else
 		{
-			ta[i] = x->a[i];
-			tb[i] = x->b[i];
+			outlet_anything(x->dictOutlet, gensym("frequencies"), bins, list);
+			for ( n=0; n < bins; n++ )
+				atom_setfloat(list+n, mag[n]);
+			outlet_anything(x->dictOutlet, gensym("magnitude"), bins, list);
+			for ( n=0; n < bins; n++ )
+				atom_setfloat(list+n, phase[n]);
+			outlet_anything(x->dictOutlet, gensym("phase"), bins, list);
 		}
-		
-		for ( i=2; i < x->poles+3; i++ )
+	}
+	else
+		object_error((t_object *)x, "response: out of memory");
+	
+	if (w) sysmem_freeptr(w);
+	if (mag) sysmem_freeptr(mag);
+	if (phase) sysmem_freeptr(phase);
+	if (list) sysmem_freeptr(list);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//	atlas <file>
+//	Look designs up in an atlas built by tools/chebatlas, for every cheb. Without a file, posts the
+//	atlas in use.
+void cheb_atlasMsg(t_cheb *x, t_symbol *s, long argc, t_atom *argv)
+{
+	const t_chebatlasheader *h;
+	const char *err;
+	
+	if ( argc > 0 && atom_gettype(argv) == A_SYM )
+	{
+		if ( (err = cheb_atlas_load(atom_getsym(argv)->s_name)) )
 		{
-			x->a[i] = A0*ta[i] + A1*ta[i-1] + A2*ta[i-2];
-			x->b[i] = tb[i] - B1*tb[i-1] - B2*tb[i-2];
+			object_error((t_object *)x, "atlas %s: %s", atom_getsym(argv)->s_name, err);
+			return;
 		}
+		//	this instance's design may be on the grid
+		cheb_calculate(x);
+		cheb_bang(x);
 	}
-	sysmem_freeptr(ta);
-	sysmem_freeptr(tb);
-		
-	// Finish combining coefficients
-	x->b[2] = 0;
-	for ( i=0; i<x->poles+1; i++ )
+	
+	if ( cheb_atlas && (h = cheb_atlas->header) )
+		object_post((t_object *)x, "atlas %s: %u-%u poles, %u ripples, %u cutoffs at %g Hz%s",
+			cheb_atlasName->s_name, h->minPoles, h->maxPoles, h->rippleCount, h->cutoffCount, h->sampleRate,
+			h->sampleRate == cheb_samplerate(x) ? "" : " (not the current sample rate, unused)");
+	else
+		object_post((t_object *)x, "no atlas loaded");
+}
+
+//	Map an atlas by file name in the search path, or by absolute path, and make it the one in use.
+//	Returns NULL on success or what went wrong.
+const char *cheb_atlas_load(const char *name)
+{
+	char		filename[MAX_PATH_CHARS], path[MAX_PATH_CHARS];
+	short		vol;
+	t_fourcc	type;
+	const char	*err;
+	t_chebatlas	*atlas;
+	
+	strncpy_zero(filename, name, MAX_PATH_CHARS);
+	if ( locatefile_extended(filename, &vol, &type, NULL, 0) || path_toabsolutesystempath(vol, filename, path) )
+		strncpy_zero(path, name, MAX_PATH_CHARS);
+	
+	if ( !(atlas = (t_chebatlas *)sysmem_newptrclear(sizeof(t_chebatlas))) )
+		return "out of memory";
+	if ( (err = cheb_atlas_open(atlas, path)) )
 	{
-		x->a[i] = x->a[i+2];
-		x->b[i] = -x->b[i+2];
+		sysmem_freeptr(atlas);
+		return err;
 	}
 	
-	// NORMALIZE THE GAIN
-	sa = 0.0, sb = 0.0;
-	if ( x->lowHIGH ) {
-		for ( i=0; i<x->poles+1; i++ ) {
-// 			sa += x->a[i] * pow(-1, i);
-// 			sb += x->b[i] * pow(-1, i);
-			if ( i % 2 == 0 ) {
-				sa += x->a[i];
-				sb += x->b[i];
-			}
-			else {
-				sa -= x->a[i];
-				sb -= x->b[i];
-			}
-		}
-	}
-	else {
-		for ( i=0; i<x->poles+1; i++ ) {
-			sa += x->a[i];
-			sb += x->b[i];
-		}
-	}
+	cheb_atlas		= atlas;
+	cheb_atlasName	= gensym(name);
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//	decimate <factor>
+//	Design for an iir~ given the same "decimate" message, which runs at 1/factor of the sample rate.
+//	The cutoff stays the same in Hz, and the factor rounds down to a power of two as it does there.
+//	1 designs for the full rate.
+void cheb_decimate(t_cheb *x, long factor)
+{
+	x->decimate = iir_multirate_factor(factor);
+	x->omegah	= cheb_omegah(x->cutoff, cheb_samplerate(x));
 	
-	gain = 1 / ( sa / (1 - sb) );
+	cheb_calculate(x);
+	cheb_bang(x);
+}
+
+//	rate the designs are for
+double cheb_samplerate(t_cheb *x)
+{
+	return sys_getsr() / x->decimate;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void cheb_calculate(t_cheb *x)
+{
+	// holds the "a" & "b" coefficients upon program completion;
+	// a design on the atlas grid is copied, otherwise
+	// a cutoff or low/high change skips the pole and ripple stages
+	if ( cheb_atlas && cheb_atlas_lookup(cheb_atlas, x->a, x->b, x->poles, x->omegah, x->lowHIGH, x->ripple, cheb_samplerate(x)) )
+		return;
 	
-	for ( i=0; i<x->poles+1; i++ )
-		x->a[i] *= gain;
+	cheb_stages_design(&x->stages, x->a, x->b, x->poles, x->omegah, x->lowHIGH, x->ripple);
 }
 
 ///////////////////////////////////////////////
@@ -489,8 +665,8 @@ void cheb_getPointers	(t_cheb *x)
 {
 	if (!x->a && !x->b)	//	all must be zero
 	{
-		x->a	= (double *)sysmem_newptr((x->poles+3) * sizeof(double));
-		x->b	= (double *)sysmem_newptr((x->poles+3) * sizeof(double));
+		x->a	= (double *)sysmem_newptr(CHEB_WORK_SIZE(x->poles) * sizeof(double));
+		x->b	= (double *)sysmem_newptr(CHEB_WORK_SIZE(x->poles) * sizeof(double));
 	}
 	else
 		error("cheb_getPointers; one pointer was not zero.");
@@ -0,0 +1,266 @@
+/**
+*	Precomputed Chebyshev designs, memory mapped from an atlas file built by tools/chebatlas.
+*	This file has no Max dependencies.
+*
+*	An atlas holds the a[] and b[] lists that cheb_design() produces for every combination of a
+*	grid of pole counts, ripples and cutoffs, for low and high pass, at one sample rate. The file is
+*	mapped read only, so every process using the same atlas shares one copy of it in memory.
+*	Only exact grid points are found; anything else is designed as usual.
+*
+*	Layout, in native byte order, every section 8 byte aligned:
+*		t_chebatlasheader
+*		double ripple[rippleCount]			ascending
+*		double cutoff[cutoffCount]			Hz, ascending
+*		double omegah[cutoffCount]			cheb_omegah() of each cutoff at sampleRate
+*		double data[2][poleCount][rippleCount][cutoffCount][stride]
+*	Each record is a[0..maxPoles] followed by b[0..maxPoles]; entries past the record's pole count
+*	are zero. Pole counts run from minPoles to maxPoles in steps of 2.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#ifndef CHEB_ATLAS_H
+#define CHEB_ATLAS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef WIN_VERSION
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cheb_design.h"
+
+#define CHEB_ATLAS_MAGIC		"CHEBATLS"
+#define CHEB_ATLAS_VERSION		1
+//	reads back differently on a machine with the other byte order
+#define CHEB_ATLAS_BYTE_ORDER	0x01020304
+
+typedef struct
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	byteOrder;
+	double		sampleRate;
+	uint32_t	minPoles, maxPoles;
+	uint32_t	rippleCount, cutoffCount;
+	uint32_t	stride;						//	doubles per record, 2*(maxPoles+1)
+	uint32_t	reserved;
+	uint64_t	rippleOffset, cutoffOffset, omegahOffset, dataOffset;	//	bytes from the start of the file
+	uint64_t	fileSize;
+} t_chebatlasheader;
+
+typedef struct
+{
+	const t_chebatlasheader *header;		//	NULL when nothing is mapped
+	const double *ripple, *cutoff, *omegah, *data;
+	size_t size;
+#ifdef WIN_VERSION
+	HANDLE file, mapping;
+#endif
+} t_chebatlas;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static inline long cheb_atlas_pole_count(const t_chebatlasheader *h)
+{
+	return (h->maxPoles - h->minPoles)/2 + 1;
+}
+
+//	offset in doubles from the start of the data to a record
+static inline uint64_t cheb_atlas_record(const t_chebatlasheader *h, int lowHIGH, long poleIndex, long rippleIndex, long cutoffIndex)
+{
+	return ((((uint64_t)lowHIGH * cheb_atlas_pole_count(h) + poleIndex) * h->rippleCount + rippleIndex) * h->cutoffCount + cutoffIndex) * h->stride;
+}
+
+//	Fill in every offset of a header from its grid; the writer then puts each section at its offset.
+static inline void cheb_atlas_layout(t_chebatlasheader *h)
+{
+	memcpy(h->magic, CHEB_ATLAS_MAGIC, 8);
+	h->version		= CHEB_ATLAS_VERSION;
+	h->byteOrder	= CHEB_ATLAS_BYTE_ORDER;
+	h->stride		= 2*(h->maxPoles+1);
+	h->reserved		= 0;
+	h->rippleOffset	= sizeof(t_chebatlasheader);
+	h->cutoffOffset	= h->rippleOffset + h->rippleCount * sizeof(double);
+	h->omegahOffset	= h->cutoffOffset + h->cutoffCount * sizeof(double);
+	h->dataOffset	= h->omegahOffset + h->cutoffCount * sizeof(double);
+	h->fileSize		= h->dataOffset + cheb_atlas_record(h, 2, 0, 0, 0) * sizeof(double);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static inline void cheb_atlas_close(t_chebatlas *atlas)
+{
+	if ( atlas->header )
+	{
+#ifdef WIN_VERSION
+		UnmapViewOfFile((LPCVOID)atlas->header);
+		CloseHandle(atlas->mapping);
+		CloseHandle(atlas->file);
+#else
+		munmap((void *)atlas->header, atlas->size);
+#endif
+	}
+	atlas->header = NULL;
+}
+
+//	Map an atlas file read only. Returns NULL on success, or what is wrong with the file.
+static inline const char *cheb_atlas_open(t_chebatlas *atlas, const char *path)
+{
+	const t_chebatlasheader *h;
+	const void *base;
+	size_t size;
+
+	atlas->header = NULL;
+
+#ifdef WIN_VERSION
+	{
+		LARGE_INTEGER fileSize;
+
+		atlas->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if ( atlas->file == INVALID_HANDLE_VALUE )
+			return "cannot open file";
+		if ( !GetFileSizeEx(atlas->file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(t_chebatlasheader) )
+		{
+			CloseHandle(atlas->file);
+			return "not an atlas";
+		}
+		size = (size_t)fileSize.QuadPart;
+		atlas->mapping = CreateFileMapping(atlas->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if ( !atlas->mapping )
+		{
+			CloseHandle(atlas->file);
+			return "cannot map file";
+		}
+		base = MapViewOfFile(atlas->mapping, FILE_MAP_READ, 0, 0, 0);
+		if ( !base )
+		{
+			CloseHandle(atlas->mapping);
+			CloseHandle(atlas->file);
+			return "cannot map file";
+		}
+	}
+#else
+	{
+		struct stat st;
+		int fd = open(path, O_RDONLY);
+
+		if ( fd < 0 )
+			return "cannot open file";
+		if ( fstat(fd, &st) || st.st_size < (off_t)sizeof(t_chebatlasheader) )
+		{
+			close(fd);
+			return "not an atlas";
+		}
+		size = (size_t)st.st_size;
+		base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);		//	the mapping keeps the file
+		if ( base == MAP_FAILED )
+			return "cannot map file";
+	}
+#endif
+
+	atlas->header	= h = (const t_chebatlasheader *)base;
+	atlas->size		= size;
+
+	if ( memcmp(h->magic, CHEB_ATLAS_MAGIC, 8) )
+	{
+		cheb_atlas_close(atlas);
+		return "not an atlas";
+	}
+	if ( h->version != CHEB_ATLAS_VERSION )
+	{
+		cheb_atlas_close(atlas);
+		return "unsupported atlas version";
+	}
+	if ( h->byteOrder != CHEB_ATLAS_BYTE_ORDER )
+	{
+		cheb_atlas_close(atlas);
+		return "atlas was written on a machine with a different byte order";
+	}
+
+	//	everything the lookup relies on must agree with the grid
+	{
+		t_chebatlasheader check = *h;
+
+		if ( h->minPoles < 2 || h->maxPoles > MAX_CHEB_POLES || h->minPoles > h->maxPoles
+			|| (h->minPoles & 1) || (h->maxPoles & 1) || !h->rippleCount || !h->cutoffCount )
+		{
+			cheb_atlas_close(atlas);
+			return "bad atlas grid";
+		}
+		cheb_atlas_layout(&check);
+		if ( memcmp(&check, h, sizeof(check)) || h->fileSize != size )
+		{
+			cheb_atlas_close(atlas);
+			return "atlas is damaged or truncated";
+		}
+	}
+
+	atlas->ripple	= (const double *)((const char *)base + h->rippleOffset);
+	atlas->cutoff	= (const double *)((const char *)base + h->cutoffOffset);
+	atlas->omegah	= (const double *)((const char *)base + h->omegahOffset);
+	atlas->data		= (const double *)((const char *)base + h->dataOffset);
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//	index of value in the ascending list, or -1
+static inline long cheb_atlas_find(const double *list, long count, double value)
+{
+	long lo = 0, hi = count-1;
+
+	while ( lo <= hi )
+	{
+		long mid = (lo + hi) / 2;
+
+		if ( list[mid] < value )
+			lo = mid+1;
+		else if ( list[mid] > value )
+			hi = mid-1;
+		else
+			return mid;
+	}
+	return -1;
+}
+
+//	Fill a[0..poles] and b[0..poles] from the atlas if the design is on its grid, returning 1,
+//	otherwise return 0 and leave them alone.
+static inline int cheb_atlas_lookup(const t_chebatlas *atlas, double *a, double *b, long poles, double omegah, int lowHIGH, double ripple, double sampleRate)
+{
+	const t_chebatlasheader *h = atlas->header;
+	const double *record;
+	long r, c, i;
+
+	if ( !h || sampleRate != h->sampleRate || poles < (long)h->minPoles || poles > (long)h->maxPoles || (poles & 1) )
+		return 0;
+	if ( (r = cheb_atlas_find(atlas->ripple, h->rippleCount, ripple)) < 0
+		|| (c = cheb_atlas_find(atlas->omegah, h->cutoffCount, omegah)) < 0 )
+		return 0;
+
+	record = atlas->data + cheb_atlas_record(h, lowHIGH != 0, (poles - h->minPoles)/2, r, c);
+	for ( i=0; i <= poles; i++ )
+	{
+		a[i] = record[i];
+		b[i] = record[h->maxPoles+1 + i];
+	}
+	return 1;
+}
+
+#endif
@@ -0,0 +1,548 @@
+/**
+*	Chebyshev coefficient design, shared by the cheb external and the command line tools.
+*	This file has no Max dependencies.
+*
+*   Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Part of this code was adapted from
+*       "The Scientist and Engineer's Guide to Digital Signal Processing" 2nd edition
+*       by Steven W. Smith
+*       Chebyshev filter page 340, Table 20-4
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+
+#ifndef CHEB_DESIGN_H
+#define CHEB_DESIGN_H
+
+#include <math.h>
+
+//	No fused multiply-adds, so the externals and the tools round alike. clang and MSVC take it from
+//	here; gcc needs -ffp-contract=off, which tools/Makefile passes.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(_MSC_VER)
+#pragma fp_contract (off)
+#endif
+
+#ifndef	pi
+#define	pi		3.1415926535897932384626433
+#endif
+
+//	double	T	= 2.0 * tan(0.5);
+#define	T		1.0926049796875809683172064978862181305885
+//	double	TT	= T * T;
+#define	TT		1.1937856416380991930736854556016623973846
+
+#define MAX_CHEB_POLES	20
+
+//	a[] and b[] must have room for this many values while designing
+#define CHEB_WORK_SIZE(poles)	((poles)+3)
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//	floor() to the lower even number (ignore last bit)
+static inline long cheb_limit_poles(long p)
+{
+	return ( (p > MAX_CHEB_POLES) ? MAX_CHEB_POLES : ((p < 0) ? 0 : p ) ) & 0xFFFFFFFE;
+}
+
+static inline double cheb_limit_ripple(double r)
+{
+	return (r>29.0) ? 29.0 : ((r<0.0) ? 0.0 : r);
+}
+
+//	Cutoff in Hz to the omegah the design takes: a fraction of the sample rate, limited to 0-0.5,
+//	times pi (not 2¹); omegah contains true omega/2 (omega-half)
+static inline double cheb_omegah(double hz, double samplerate)
+{
+	double c = hz / samplerate;
+
+	return ( c > 0.5 ? 0.5 : (c < 0.0 ? 0.0 : c) ) * pi;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Ellipse warp for percentage ripple; both results are zero when there is no ripple.
+static inline void cheb_design_ripple(double ripple, long poles, double *sinhVXoKX, double *coshVXoKX)
+{
+	double	ESinv, VX, KX;
+
+	if ( ripple > 0.0 )
+	{
+		ESinv	= 1.0 / sqrt( pow(100.0/(100.0 - ripple), 2.0) - 1.0 );
+		VX		= asinh(ESinv) / (double)poles;
+		KX		= cosh( acosh(ESinv) / (double)poles );
+
+		*sinhVXoKX	= sinh(VX) / KX;
+		*coshVXoKX	= cosh(VX) / KX;
+	}
+	else
+	{
+		*sinhVXoKX	= 0.0;
+		*coshVXoKX	= 0.0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Intermediate results of each design stage, so that a change only recomputes from the
+//	stage it affects. Pole positions depend only on poles, the ellipse warp and s-to-z terms
+//	only on poles and ripple, and only the LP/HP transform and cascade depend on the cutoff.
+typedef struct _chebstages
+{
+	long	poles;		//	parameters the cached stages were built from, -1 when nothing is cached
+	double	ripple;
+	double	omegah;
+	int		lowHIGH;
+
+	//	poles stage: unit circle pole location for each pole pair
+	double	RP[MAX_CHEB_POLES/2], IP[MAX_CHEB_POLES/2];
+
+	//	ripple stage: ellipse warp and s-domain to z-domain terms, X1 = 2*X0 and X2 = X0
+	double	sinhVXoKX, coshVXoKX;
+	double	X0[MAX_CHEB_POLES/2], Y1[MAX_CHEB_POLES/2], Y2[MAX_CHEB_POLES/2];
+
+	//	cutoff stage: second order section for each pole pair, before the gain is normalized
+	double	A0[MAX_CHEB_POLES/2], A1[MAX_CHEB_POLES/2], A2[MAX_CHEB_POLES/2];
+	double	B1[MAX_CHEB_POLES/2], B2[MAX_CHEB_POLES/2];
+	double	gain;
+} t_chebstages;
+
+static inline void cheb_stages_init(t_chebstages *st)
+{
+	st->poles = -1;
+	st->ripple = -1.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static inline void cheb_stage_poles(t_chebstages *st, long poles)
+{
+	double	piPoles		= pi/poles;
+	double	piPoles2	= pi/(poles*2.0);
+	long	p;
+
+	for ( p=1; p <= poles/2; p++ )
+	{
+		// calculate the pole location on the unit circle
+		st->RP[p-1] = -cos(piPoles2 + (p-1) * piPoles);
+		st->IP[p-1] =  sin(piPoles2 + (p-1) * piPoles);
+	}
+	st->poles = poles;
+}
+
+static inline void cheb_stage_ripple(t_chebstages *st, double ripple)
+{
+	double	RP, IP, M, D;
+	long	p;
+
+	cheb_design_ripple(ripple, st->poles, &st->sinhVXoKX, &st->coshVXoKX);
+
+	for ( p=1; p <= st->poles/2; p++ )
+	{
+		RP = st->RP[p-1];
+		IP = st->IP[p-1];
+
+		// Warp from a circle to an ellipse when ripple is greater than zero
+		if ( ripple > 0 )
+		{
+			RP *= st->sinhVXoKX;
+			IP *= st->coshVXoKX;
+		}
+
+		// s-domain to z-domain conversion
+		M	= RP*RP + IP*IP;
+		D	= 4.0 - 4.0*RP*T + M*TT;
+		st->X0[p-1]	= TT/D;
+		st->Y1[p-1]	= (8.0 - 2.0*M*TT)/D;
+		st->Y2[p-1]	= (-4.0 - 4.0*RP*T - M*TT)/D;
+	}
+	st->ripple = ripple;
+}
+
+//	a[] and b[] need CHEB_WORK_SIZE(poles) elements
+static inline void cheb_stage_cutoff(t_chebstages *st, double *a, double *b, double omegah, int lowHIGH)
+{
+	// internal use for combining stages
+	double	ta[CHEB_WORK_SIZE(MAX_CHEB_POLES)], tb[CHEB_WORK_SIZE(MAX_CHEB_POLES)];
+
+	long	poles = st->poles;
+	double	K, KK;
+	double	D, X0, X1, X2, Y1, Y2;
+	double	A0, A1, A2, B1, B2, sa, sb, gain;
+	long 	p, i;
+
+	// INITIALIZE VARIABLES
+	for ( i=0; i < poles+3; i++ )
+	{
+		a[i] = 0.0;
+		b[i] = 0.0;
+	}
+
+	a[2] = 1.0;
+	b[2] = 1.0;
+
+	// LP TO LP, or LP TO HP transform	(new calculation not needed when ripple changes)
+	if ( lowHIGH )
+		K = -cos(omegah + 0.5) / cos(omegah - 0.5);
+	else
+		K =  sin(0.5 - omegah) / sin(0.5 + omegah);
+
+	KK = K * K;
+
+	// LOOP FOR EACH POLE-PAIR
+	for ( p=1; p <= poles/2; p++ )
+	{
+		X0	= st->X0[p-1];
+		X1	= 2.0*X0;
+		X2	= X0;
+		Y1	= st->Y1[p-1];
+		Y2	= st->Y2[p-1];
+
+		D = 1 + Y1*K - Y2*KK;
+
+		A0	= (X0 - X1*K + X2*KK)/D;
+		A1	= (-2*X0*K + X1 + X1*KK - 2*X2*K)/D;
+		A2	= (X0*KK - X1*K + X2)/D;
+		B1	= (2*K + Y1 + Y1*KK - 2*Y2*K)/D;
+		B2	= (-KK - Y1*K + Y2)/D;
+
+		if ( lowHIGH )
+		{
+			A1 = -A1;
+			B1 = -B1;
+		}
+
+		st->A0[p-1] = A0;
+		st->A1[p-1] = A1;
+		st->A2[p-1] = A2;
+		st->B1[p-1] = B1;
+		st->B2[p-1] = B2;
+
+		// Add coefficients to the cascade
+		for ( i=0; i < poles+3; i++ )
+		{
+			ta[i] = a[i];
+			tb[i] = b[i];
+		}
+
+		for ( i=2; i < poles+3; i++ )
+		{
+			a[i] = A0*ta[i] + A1*ta[i-1] + A2*ta[i-2];
+			b[i] = tb[i] - B1*tb[i-1] - B2*tb[i-2];
+		}
+	}
+
+	// Finish combining coefficients
+	b[2] = 0;
+	for ( i=0; i<poles+1; i++ )
+	{
+		a[i] = a[i+2];
+		b[i] = -b[i+2];
+	}
+
+	// NORMALIZE THE GAIN
+	sa = 0.0, sb = 0.0;
+	if ( lowHIGH ) {
+		for ( i=0; i<poles+1; i++ ) {
+			if ( i % 2 == 0 ) {
+				sa += a[i];
+				sb += b[i];
+			}
+			else {
+				sa -= a[i];
+				sb -= b[i];
+			}
+		}
+	}
+	else {
+		for ( i=0; i<poles+1; i++ ) {
+			sa += a[i];
+			sb += b[i];
+		}
+	}
+
+	gain = 1 / ( sa / (1 - sb) );
+
+	for ( i=0; i<poles+1; i++ )
+		a[i] *= gain;
+
+	st->gain	= gain;
+	st->omegah	= omegah;
+	st->lowHIGH	= lowHIGH;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Cutoff stage for many cutoffs at once, for sweeps. The designs are independent, so they are
+//	computed CHEB_LANES at a time with the lane as the innermost loop, which the compiler turns into
+//	SIMD arithmetic. Results are bit-identical to cheb_stage_cutoff(). Design n is written to
+//	a[n*(poles+1) ...] and b[n*(poles+1) ...]. The poles and ripple stages must already be cached.
+#define CHEB_LANES	4
+
+static inline void cheb_stage_cutoff_sweep(const t_chebstages *st, double *a, double *b, const double *omegah, long count, int lowHIGH)
+{
+	double	la[CHEB_WORK_SIZE(MAX_CHEB_POLES)][CHEB_LANES], lb[CHEB_WORK_SIZE(MAX_CHEB_POLES)][CHEB_LANES];
+	double	ta[CHEB_WORK_SIZE(MAX_CHEB_POLES)][CHEB_LANES], tb[CHEB_WORK_SIZE(MAX_CHEB_POLES)][CHEB_LANES];
+	double	K[CHEB_LANES], KK[CHEB_LANES], D[CHEB_LANES];
+	double	A0[CHEB_LANES], A1[CHEB_LANES], A2[CHEB_LANES], B1[CHEB_LANES], B2[CHEB_LANES];
+	double	sa[CHEB_LANES], sb[CHEB_LANES], gain[CHEB_LANES];
+	double	X0, X1, X2, Y1, Y2;
+	long	poles = st->poles;
+	long	n, l, lanes, p, i;
+
+	for ( n=0; n < count; n += CHEB_LANES )
+	{
+		lanes = (count - n < CHEB_LANES) ? count - n : CHEB_LANES;
+
+		for ( i=0; i < poles+3; i++ )
+			for ( l=0; l < CHEB_LANES; l++ )
+				la[i][l] = lb[i][l] = 0.0;
+
+		for ( l=0; l < CHEB_LANES; l++ )
+		{
+			la[2][l] = 1.0;
+			lb[2][l] = 1.0;
+		}
+
+		// LP TO LP, or LP TO HP transform; unused lanes repeat the last cutoff
+		for ( l=0; l < CHEB_LANES; l++ )
+		{
+			double w = omegah[n + (l < lanes ? l : lanes-1)];
+			if ( lowHIGH )
+				K[l] = -cos(w + 0.5) / cos(w - 0.5);
+			else
+				K[l] =  sin(0.5 - w) / sin(0.5 + w);
+			KK[l] = K[l] * K[l];
+		}
+
+		for ( p=1; p <= poles/2; p++ )
+		{
+			X0	= st->X0[p-1];
+			X1	= 2.0*X0;
+			X2	= X0;
+			Y1	= st->Y1[p-1];
+			Y2	= st->Y2[p-1];
+
+			for ( l=0; l < CHEB_LANES; l++ )
+			{
+				D[l] = 1 + Y1*K[l] - Y2*KK[l];
+
+				A0[l]	= (X0 - X1*K[l] + X2*KK[l])/D[l];
+				A1[l]	= (-2*X0*K[l] + X1 + X1*KK[l] - 2*X2*K[l])/D[l];
+				A2[l]	= (X0*KK[l] - X1*K[l] + X2)/D[l];
+				B1[l]	= (2*K[l] + Y1 + Y1*KK[l] - 2*Y2*K[l])/D[l];
+				B2[l]	= (-KK[l] - Y1*K[l] + Y2)/D[l];
+
+				if ( lowHIGH )
+				{
+					A1[l] = -A1[l];
+					B1[l] = -B1[l];
+				}
+			}
+
+			// Add coefficients to the cascade
+			for ( i=0; i < poles+3; i++ )
+				for ( l=0; l < CHEB_LANES; l++ )
+				{
+					ta[i][l] = la[i][l];
+					tb[i][l] = lb[i][l];
+				}
+
+			for ( i=2; i < poles+3; i++ )
+				for ( l=0; l < CHEB_LANES; l++ )
+				{
+					la[i][l] = A0[l]*ta[i][l] + A1[l]*ta[i-1][l] + A2[l]*ta[i-2][l];
+					lb[i][l] = tb[i][l] - B1[l]*tb[i-1][l] - B2[l]*tb[i-2][l];
+				}
+		}
+
+		// Finish combining coefficients
+		for ( l=0; l < CHEB_LANES; l++ )
+			lb[2][l] = 0;
+		for ( i=0; i<poles+1; i++ )
+			for ( l=0; l < CHEB_LANES; l++ )
+			{
+				la[i][l] = la[i+2][l];
+				lb[i][l] = -lb[i+2][l];
+			}
+
+		// NORMALIZE THE GAIN
+		for ( l=0; l < CHEB_LANES; l++ )
+			sa[l] = sb[l] = 0.0;
+		for ( i=0; i<poles+1; i++ )
+		{
+			if ( lowHIGH && i % 2 )
+			{
+				for ( l=0; l < CHEB_LANES; l++ )
+				{
+					sa[l] -= la[i][l];
+					sb[l] -= lb[i][l];
+				}
+			}
+			else
+			{
+				for ( l=0; l < CHEB_LANES; l++ )
+				{
+					sa[l] += la[i][l];
+					sb[l] += lb[i][l];
+				}
+			}
+		}
+
+		for ( l=0; l < CHEB_LANES; l++ )
+			gain[l] = 1 / ( sa[l] / (1 - sb[l]) );
+
+		for ( l=0; l < lanes; l++ )
+			for ( i=0; i<poles+1; i++ )
+			{
+				a[(n+l)*(poles+1) + i] = la[i][l] * gain[l];
+				b[(n+l)*(poles+1) + i] = lb[i][l];
+			}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Fills a[0..poles] and b[0..poles], recomputing only the stages whose parameters changed.
+//	Both arrays need CHEB_WORK_SIZE(poles) elements.
+//	omegah is the cutoff as a fraction of the sample rate times pi (not 2¹).
+static inline void cheb_stages_design(t_chebstages *st, double *a, double *b, long poles, double omegah, int lowHIGH, double ripple)
+{
+	if ( poles != st->poles )
+	{
+		cheb_stage_poles(st, poles);
+		cheb_stage_ripple(st, ripple);
+	}
+	else if ( ripple != st->ripple )
+		cheb_stage_ripple(st, ripple);
+
+	cheb_stage_cutoff(st, a, b, omegah, lowHIGH);
+}
+
+//	Design from scratch without keeping any of the intermediate stages.
+static inline void cheb_design(double *a, double *b, long poles, double omegah, int lowHIGH, double ripple)
+{
+	t_chebstages st;
+
+	cheb_stages_init(&st);
+	cheb_stages_design(&st, a, b, poles, omegah, lowHIGH, ripple);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Frequency response H(e^jw) at count frequencies w[] (radians per sample, 0 to pi), as
+//	magnitude and phase. Bins are computed CHEB_LANES at a time with the lane innermost, like
+//	cheb_stage_cutoff_sweep().
+
+//	True when the cutoff stage holds the sections of the design with these parameters.
+static inline int cheb_stages_current(const t_chebstages *st, long poles, double omegah, int lowHIGH, double ripple)
+{
+	return st->poles == poles && st->ripple == ripple && st->omegah == omegah && st->lowHIGH == lowHIGH;
+}
+
+//	From the cached sections: gain times the product of (A0 + A1 z^-1 + A2 z^-2) / (1 - B1 z^-1 - B2 z^-2).
+static inline void cheb_response_sections(const t_chebstages *st, const double *w, long count, double *mag, double *phase)
+{
+	double	c1[CHEB_LANES], s1[CHEB_LANES], c2[CHEB_LANES], s2[CHEB_LANES];
+	double	nr[CHEB_LANES], ni[CHEB_LANES], dr[CHEB_LANES], di[CHEB_LANES];
+	long	n, l, lanes, p;
+
+	for ( n=0; n < count; n += CHEB_LANES )
+	{
+		lanes = (count - n < CHEB_LANES) ? count - n : CHEB_LANES;
+
+		//	z^-1 and z^-2 on the unit circle; unused lanes repeat the last bin
+		for ( l=0; l < CHEB_LANES; l++ )
+		{
+			double x = w[n + (l < lanes ? l : lanes-1)];
+			c1[l] = cos(x);
+			s1[l] = -sin(x);
+			c2[l] = c1[l]*c1[l] - s1[l]*s1[l];
+			s2[l] = 2.0*c1[l]*s1[l];
+			nr[l] = st->gain;
+			ni[l] = 0.0;
+			dr[l] = 1.0;
+			di[l] = 0.0;
+		}
+
+		for ( p=0; p < st->poles/2; p++ )
+		{
+			double A0 = st->A0[p], A1 = st->A1[p], A2 = st->A2[p], B1 = st->B1[p], B2 = st->B2[p];
+
+			for ( l=0; l < CHEB_LANES; l++ )
+			{
+				double sr = A0 + A1*c1[l] + A2*c2[l], si = A1*s1[l] + A2*s2[l];
+				double tr = 1.0 - B1*c1[l] - B2*c2[l], ti = -B1*s1[l] - B2*s2[l];
+				double r;
+
+				r		= nr[l]*sr - ni[l]*si;
+				ni[l]	= nr[l]*si + ni[l]*sr;
+				nr[l]	= r;
+				r		= dr[l]*tr - di[l]*ti;
+				di[l]	= dr[l]*ti + di[l]*tr;
+				dr[l]	= r;
+			}
+		}
+
+		for ( l=0; l < lanes; l++ )
+		{
+			mag[n+l]	= sqrt( (nr[l]*nr[l] + ni[l]*ni[l]) / (dr[l]*dr[l] + di[l]*di[l]) );
+			phase[n+l]	= atan2(ni[l]*dr[l] - nr[l]*di[l], nr[l]*dr[l] + ni[l]*di[l]);
+		}
+	}
+}
+
+//	From a[0..poles] and b[1..poles] in the same convention as the output list:
+//	(a0 + a1 z^-1 + ... ) / (1 - b1 z^-1 - ... ), both polynomials by Horner's rule in z^-1.
+static inline void cheb_response_poly(const double *a, const double *b, long poles, const double *w, long count, double *mag, double *phase)
+{
+	double	zr[CHEB_LANES], zi[CHEB_LANES];
+	double	nr[CHEB_LANES], ni[CHEB_LANES], dr[CHEB_LANES], di[CHEB_LANES];
+	long	n, l, lanes, i;
+
+	for ( n=0; n < count; n += CHEB_LANES )
+	{
+		lanes = (count - n < CHEB_LANES) ? count - n : CHEB_LANES;
+
+		for ( l=0; l < CHEB_LANES; l++ )
+		{
+			double x = w[n + (l < lanes ? l : lanes-1)];
+			zr[l] = cos(x);
+			zi[l] = -sin(x);
+			nr[l] = a[poles];
+			ni[l] = 0.0;
+			dr[l] = poles > 0 ? -b[poles] : 1.0;
+			di[l] = 0.0;
+		}
+
+		for ( i=poles-1; i >= 0; i-- )
+		{
+			double ai = a[i], bi = i ? -b[i] : 1.0;
+
+			for ( l=0; l < CHEB_LANES; l++ )
+			{
+				double r;
+
+				r		= nr[l]*zr[l] - ni[l]*zi[l] + ai;
+				ni[l]	= nr[l]*zi[l] + ni[l]*zr[l];
+				nr[l]	= r;
+				r		= dr[l]*zr[l] - di[l]*zi[l] + bi;
+				di[l]	= dr[l]*zi[l] + di[l]*zr[l];
+				dr[l]	= r;
+			}
+		}
+
+		for ( l=0; l < lanes; l++ )
+		{
+			mag[n+l]	= sqrt( (nr[l]*nr[l] + ni[l]*ni[l]) / (dr[l]*dr[l] + di[l]*di[l]) );
+			phase[n+l]	= atan2(ni[l]*dr[l] - nr[l]*di[l], nr[l]*dr[l] + ni[l]*di[l]);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,238 @@
+/**
+*	Kernel selection for iir~: a short benchmark of every steady state kernel on the current
+*	coefficients and vector size, and the profile lines that keep the results between runs.
+*	This file has no Max dependencies.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#ifndef IIR_AUTOTUNE_H
+#define IIR_AUTOTUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN_VERSION
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "iir_kernel.h"
+
+//	kernels for when no ramp is running; ramps always go through iir_state_tick()
+enum
+{
+	IIR_KERNEL_TICK,				//	iir_state_tick() per sample
+	IIR_KERNEL_BLOCK,				//	iir_state_block(), same output as tick
+	IIR_KERNEL_SPLIT,				//	iir_state_split(), feedforward looked ahead
+	IIR_KERNEL_UNROLLED,			//	iir_state_unrolled(), four partial sums
+	IIR_KERNEL_TRANSPOSED,			//	iir_state_transposed(), transposed direct form II
+	IIR_KERNEL_COUNT
+};
+
+static const char *iir_kernel_names[IIR_KERNEL_COUNT] = { "tick", "block", "split", "unrolled", "transposed" };
+
+//	a kernel that does not match tick bit for bit has to be this much faster to be chosen
+#define IIR_AUTOTUNE_MARGIN		0.05
+
+#define IIR_AUTOTUNE_TRIALS		5
+#define IIR_AUTOTUNE_SAMPLES	32768	//	per trial
+
+typedef struct
+{
+	char machine[64];
+	int precision;					//	32 or 64 bit signal vectors
+	long poles;
+	long vectorSize;
+	int kernel;						//	the fastest
+	double nsPerSample[IIR_KERNEL_COUNT];
+} t_iirprofile;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	seconds from a high resolution clock
+static inline double iir_autotune_now(void)
+{
+#ifdef WIN_VERSION
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+//	name of this machine, with no white space
+static inline void iir_autotune_machine(char *name, size_t size)
+{
+	char *c;
+
+#ifdef WIN_VERSION
+	DWORD length = (DWORD)size;
+	if ( !GetComputerNameA(name, &length) )
+		strncpy(name, "unknown", size);
+#else
+	if ( gethostname(name, size) )
+		strncpy(name, "unknown", size);
+#endif
+	name[size-1] = '\0';
+	for ( c=name; *c; c++ ) {
+		if ( *c == ' ' || *c == '\t' || *c == '\n' )
+			*c = '_';
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Run n samples through a steady state kernel.
+static inline void iir_kernel_run(t_iirstate *s, int kernel, const double *in, double *out, long n)
+{
+	long i;
+
+	switch ( kernel ) {
+		case IIR_KERNEL_BLOCK:
+			iir_state_block(s, in, out, n);
+			break;
+		case IIR_KERNEL_SPLIT:
+			iir_state_split(s, in, out, n);
+			break;
+		case IIR_KERNEL_UNROLLED:
+			iir_state_unrolled(s, in, out, n);
+			break;
+		case IIR_KERNEL_TRANSPOSED:
+			iir_state_transposed(s, in, out, n);
+			break;
+		default:
+			for ( i=0; i<n; i++ )
+				out[i] = iir_state_tick(s, in[i]);
+	}
+}
+
+//	Time every kernel on a copy of the target coefficients of live, one vectorSize vector at a time,
+//	converting from and to float vectors when precision is 32, the way the perform routine does.
+//	Fills in everything in result but machine. Returns 0 if out of memory.
+static inline int iir_autotune_measure(const t_iirstate *live, long vectorSize, int precision, t_iirprofile *result)
+{
+	long vectors = IIR_AUTOTUNE_SAMPLES / vectorSize > 0 ? IIR_AUTOTUNE_SAMPLES / vectorSize : 1;
+	long capacity = live->capacity, i, p, v, t;
+	double *mem = (double *)malloc(IIR_STATE_SIZE(capacity) * sizeof(double));
+	double *in = (double *)malloc(vectorSize * sizeof(double));
+	double *out = (double *)malloc(vectorSize * sizeof(double));
+	float *fin = (float *)malloc(vectorSize * sizeof(float));
+	float *fout = (float *)malloc(vectorSize * sizeof(float));
+	unsigned long noise = 1;
+	t_iirstate s;
+	int k;
+
+	if ( !mem || !in || !out || !fin || !fout ) {
+		free(mem); free(in); free(out); free(fin); free(fout);
+		return 0;
+	}
+
+	//	quiet noise, so the filter is busy but nowhere near overflow
+	for ( i=0; i<vectorSize; i++ ) {
+		noise = noise * 1664525 + 1013904223;
+		in[i] = ((double)(noise & 0xFFFF) / 32768.0 - 1.0) * 0.01;
+		fin[i] = (float)in[i];
+	}
+
+	result->precision = precision;
+	result->poles = live->poles;
+	result->vectorSize = vectorSize;
+	result->kernel = IIR_KERNEL_TICK;
+
+	for ( k=0; k<IIR_KERNEL_COUNT; k++ ) {
+		double best = 0.0;
+
+		memset(mem, 0, IIR_STATE_SIZE(capacity) * sizeof(double));
+		iir_state_attach(&s, mem, (unsigned char)capacity);
+		s.poles = live->poles;
+		s.a0 = s.aTarget0 = live->aTarget0;
+		for ( p=0; p<live->poles; p++ ) {
+			s.a[p] = s.aTarget[p] = live->aTarget[p];
+			s.b[p] = s.bTarget[p] = live->bTarget[p];
+		}
+		s.rampSteps = 1;
+		s.rampCountdown = -1;
+
+		for ( t=0; t<IIR_AUTOTUNE_TRIALS; t++ ) {
+			double start = iir_autotune_now(), elapsed;
+
+			for ( v=0; v<vectors; v++ ) {
+				if ( precision == 32 ) {
+					for ( i=0; i<vectorSize; i++ )
+						out[i] = (double)fin[i];
+					iir_kernel_run(&s, k, out, out, vectorSize);
+					for ( i=0; i<vectorSize; i++ )
+						fout[i] = (float)out[i];
+				}
+				else
+					iir_kernel_run(&s, k, in, out, vectorSize);
+			}
+
+			elapsed = iir_autotune_now() - start;
+			if ( t == 0 || elapsed < best )
+				best = elapsed;
+		}
+		result->nsPerSample[k] = best * 1e9 / ((double)vectors * vectorSize);
+	}
+
+	//	fastest, but only leave the exact kernels for a clear win
+	for ( k=1; k<IIR_KERNEL_COUNT; k++ ) {
+		double margin = k == IIR_KERNEL_BLOCK ? 1.0 : 1.0 - IIR_AUTOTUNE_MARGIN;
+		if ( result->nsPerSample[k] < result->nsPerSample[result->kernel] * margin )
+			result->kernel = k;
+	}
+
+	free(mem); free(in); free(out); free(fin); free(fout);
+	return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Profile lines:	machine precision poles vectorsize kernel ns-per-sample...
+static inline void iir_profile_format(const t_iirprofile *pr, char *line, size_t size)
+{
+	snprintf(line, size, "%s %d %ld %ld %s %.3f %.3f %.3f %.3f %.3f\n", pr->machine, pr->precision, pr->poles,
+		pr->vectorSize, iir_kernel_names[pr->kernel],
+		pr->nsPerSample[IIR_KERNEL_TICK], pr->nsPerSample[IIR_KERNEL_BLOCK], pr->nsPerSample[IIR_KERNEL_SPLIT],
+		pr->nsPerSample[IIR_KERNEL_UNROLLED], pr->nsPerSample[IIR_KERNEL_TRANSPOSED]);
+}
+
+//	Returns 1 if line is a valid profile line. Lines from before the unrolled and transposed kernels
+//	are not, so those configurations are measured again.
+static inline int iir_profile_parse(const char *line, t_iirprofile *pr)
+{
+	char kernel[16];
+	int k;
+
+	if ( sscanf(line, "%63s %d %ld %ld %15s %lf %lf %lf %lf %lf", pr->machine, &pr->precision, &pr->poles, &pr->vectorSize,
+			kernel, pr->nsPerSample + IIR_KERNEL_TICK, pr->nsPerSample + IIR_KERNEL_BLOCK, pr->nsPerSample + IIR_KERNEL_SPLIT,
+			pr->nsPerSample + IIR_KERNEL_UNROLLED, pr->nsPerSample + IIR_KERNEL_TRANSPOSED) != 10 )
+		return 0;
+
+	for ( k=0; k<IIR_KERNEL_COUNT; k++ ) {
+		if ( !strcmp(kernel, iir_kernel_names[k]) ) {
+			pr->kernel = k;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,671 @@
+/**
+*	Cross-instance batch processing for iir~.
+*
+*	Instances in batch mode hand their input to a shared engine instead of filtering it in their
+*	own perform routine. The engine groups the instances by pole count and filters up to
+*	IIR_BATCH_LANES of them together, one instance per SIMD lane, optionally spreading the groups
+*	over worker threads. There is one engine per sample rate, vector size and number of worker
+*	threads, so the voices of a poly~ share one.
+*
+*	Each perform call leaves its input in the instance's slot and takes the result for the input it
+*	left the vector before, so batch mode adds one signal vector of latency. The first member to
+*	come round again with its input still in the slot has started a new vector, so it runs the
+*	engine over everything left in the last one; with a fixed DSP chain that is the same member
+*	every vector. The run has finished every input by the time it returns, and no input is ever
+*	dropped. Instances that are ramping to new coefficients are filtered on their own with the
+*	normal kernel, so apart from the latency the output is the same as without batching.
+*
+*	Worker threads filter from a copy of the coefficients and history into a buffer of their own,
+*	and the audio thread copies the results into the members. It waits for the workers at most
+*	IIR_BATCH_WAIT_SHARE of a vector; a group a worker has not finished by then is filtered again
+*	on the audio thread and the worker's result thrown away, so a descheduled worker costs time
+*	but never a vector.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#ifndef IIR_BATCH_H
+#define IIR_BATCH_H
+
+#include "ext.h"
+#include "ext_systhread.h"
+#include "ext_atomic.h"
+#include "iir_kernel.h"
+#include "iir_autotune.h"		//	iir_autotune_now()
+
+#define IIR_BATCH_LANES			4
+#define IIR_BATCH_MAX_THREADS	16
+
+//	share of a vector's duration the audio thread waits for groups on worker threads before it
+//	filters them itself
+#define IIR_BATCH_WAIT_SHARE	0.25
+
+#ifdef WIN_VERSION
+#define IIR_BATCH_BARRIER()		MemoryBarrier()
+#else
+#define IIR_BATCH_BARRIER()		__sync_synchronize()
+#endif
+
+//	work item status, tagged with the run it belongs to so a worker that is late to an item cannot
+//	take it in a later run
+enum
+{
+	IIR_BATCH_CLOSED,					//	being built, or finished with
+	IIR_BATCH_OPEN,						//	waiting for a thread
+	IIR_BATCH_TAKEN,					//	a worker is filtering it
+	IIR_BATCH_DONE,						//	the worker's result is in its buffer
+	IIR_BATCH_STOLEN					//	the audio thread filtered it instead
+};
+#define IIR_BATCH_STATUS(run, what)	((t_int32)((((run) & 0x0FFFFFFF) << 3) | (what)))
+#define IIR_BATCH_WHAT(status)		((status) & 7)
+
+struct _iirbatch;
+
+//	one per member instance, owned by the instance
+typedef struct _iirbatchslot
+{
+	struct _iirbatch *engine;			//	engine this slot is registered with, or NULL
+	t_iirstate *state;
+	double *in, *out;					//	input waiting for the engine, and the result of the last
+	long size;							//	length of in and out
+	long frames;						//	frames in in, and in out
+	char deposited;						//	in holds input that has not been filtered yet
+} t_iirbatchslot;
+
+//	coefficients and delayed values of a group, one lane per member
+typedef struct
+{
+	double a0[IIR_BATCH_LANES];
+	double a[IIR_MAX_POLES][IIR_BATCH_LANES], b[IIR_MAX_POLES][IIR_BATCH_LANES];
+	double x[IIR_MAX_POLES][IIR_BATCH_LANES], y[IIR_MAX_POLES][IIR_BATCH_LANES];
+} t_iirbatchlanes;
+
+//	what a worker filters from and into; only its worker writes to it while held
+typedef struct
+{
+	t_iirbatchlanes from;				//	copied from the members when the work list is built
+	double x[IIR_MAX_POLES][IIR_BATCH_LANES], y[IIR_MAX_POLES][IIR_BATCH_LANES];
+	double *out;						//	IIR_BATCH_LANES vectors of results
+	volatile char held;					//	a worker the audio thread gave up on is still using it
+} t_iirbatchbuf;
+
+//	a group of slots with the same pole count filtered together
+typedef struct
+{
+	t_iirbatchslot *slot[IIR_BATCH_LANES];
+	long lanes;
+	long poles;
+	t_iirbatchbuf *buf;					//	with worker threads only
+	t_int32_atomic status;
+} t_iirbatchwork;
+
+typedef struct _iirbatch
+{
+	struct _iirbatch *next;
+	double samplerate;
+	long vectorSize;
+	long threadsWanted;					//	worker threads besides the audio thread, part of the key
+
+	t_systhread_mutex lock;				//	held while members exchange vectors and while processing
+	t_iirbatchslot **slots;
+	long count, alloc;					//	only changed with iir_batch_listlock held as well
+	t_iirbatchwork *work;				//	alloc entries
+	volatile long workCount;
+	t_iirbatchbuf *bufs;				//	alloc + threadsWanted of them, with worker threads only
+	double *bufOut;						//	their results
+	t_int32 run;						//	counts runs, for the work item status
+
+	//	worker threads; whichever is free takes the next open work item
+	long threads;
+	t_systhread thread[IIR_BATCH_MAX_THREADS];
+	t_systhread_mutex wakeLock;
+	t_systhread_cond wake;
+	long generation;
+	int quit;
+	t_int32_atomic draining;			//	workers looking through the work list
+	volatile char resizing;				//	the main thread is replacing it
+} t_iirbatch;
+
+//	engines are never freed, so a perform routine from an old DSP chain can always lock one safely
+static t_iirbatch *iir_batches;
+static t_systhread_mutex iir_batch_listlock;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	call once from main()
+static void iir_batch_init(void)
+{
+	systhread_mutex_new(&iir_batch_listlock, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Filter up to IIR_BATCH_LANES members with the same pole count, one per lane, with the same
+//	arithmetic as iir_state_tick() when it is not ramping. Lanes without a member have no in and
+//	out and run on zeros. The delayed values in v are brought up to date.
+static void iir_batch_run_lanes(t_iirbatchlanes *v, long poles, long frames, double *const *in, double *const *out)
+{
+	double x0[IIR_BATCH_LANES], y0[IIR_BATCH_LANES];
+	long l, p, n;
+
+	for ( n=0; n<frames; n++ ) {
+		for ( l=0; l<IIR_BATCH_LANES; l++ ) {
+			x0[l] = in[l] ? in[l][n] : 0.0;
+			y0[l] = x0[l] * v->a0[l];
+		}
+
+		for ( p=0; p<poles; p++ ) {
+			for ( l=0; l<IIR_BATCH_LANES; l++ ) {
+				y0[l] += v->x[p][l] * v->a[p][l];
+				y0[l] += v->y[p][l] * v->b[p][l];
+			}
+		}
+
+		//	delay values one sample
+		for ( p=poles-1; p>0; p-- ) {
+			for ( l=0; l<IIR_BATCH_LANES; l++ ) {
+				v->x[p][l] = v->x[p-1][l];
+				v->y[p][l] = v->y[p-1][l];
+			}
+		}
+		for ( l=0; l<IIR_BATCH_LANES; l++ ) {
+			v->x[0][l] = x0[l];
+			v->y[0][l] = y0[l];
+		}
+
+		for ( l=0; l<IIR_BATCH_LANES; l++ ) {
+			if ( out[l] )
+				out[l][n] = y0[l];
+		}
+	}
+}
+
+//	the members' coefficients and delayed values, lane by lane; unused lanes are zero
+static void iir_batch_gather(const t_iirbatchwork *w, t_iirbatchlanes *v)
+{
+	long poles = w->poles;
+	long l, p;
+
+	for ( l=0; l<IIR_BATCH_LANES; l++ ) {
+		t_iirstate *s = l < w->lanes ? w->slot[l]->state : NULL;
+
+		v->a0[l] = s ? s->a0 : 0.0;
+		for ( p=0; p<poles; p++ ) {
+			v->a[p][l] = s ? s->a[p] : 0.0;
+			v->b[p][l] = s ? s->b[p] : 0.0;
+			v->x[p][l] = s ? s->x[p] : 0.0;
+			v->y[p][l] = s ? s->y[p] : 0.0;
+		}
+	}
+}
+
+static void iir_batch_scatter(const t_iirbatchwork *w, double x[][IIR_BATCH_LANES], double y[][IIR_BATCH_LANES])
+{
+	long poles = w->poles;
+	long l, p;
+
+	for ( l=0; l<w->lanes; l++ ) {
+		t_iirstate *s = w->slot[l]->state;
+		for ( p=0; p<poles; p++ ) {
+			s->x[p] = x[p][l];
+			s->y[p] = y[p][l];
+		}
+	}
+}
+
+//	Audio thread: filter a group straight into its members, from v as gathered from them.
+static void iir_batch_run_direct(t_iirbatchwork *w, t_iirbatchlanes *v)
+{
+	double *in[IIR_BATCH_LANES], *out[IIR_BATCH_LANES];
+	long l;
+
+	for ( l=0; l<IIR_BATCH_LANES; l++ ) {
+		in[l] = l < w->lanes ? w->slot[l]->in : NULL;
+		out[l] = l < w->lanes ? w->slot[l]->out : NULL;
+	}
+	iir_batch_run_lanes(v, w->poles, w->slot[0]->frames, in, out);
+	iir_batch_scatter(w, v->x, v->y);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Take an open item and filter it into its buffer. What it needs from the item is read before it
+//	is taken, and the take only succeeds if the item is still open in the same run, so the reads
+//	all belong to that run; after that only the buffer is written. If the audio thread gives up on
+//	the item meanwhile, the worker finds out at the end and lets the buffer go. Returns 0 if the
+//	item was not open.
+static int iir_batch_take(t_iirbatch *e, t_iirbatchwork *w)
+{
+	t_int32 status = w->status;
+	t_iirbatchbuf *buf;
+	double *in[IIR_BATCH_LANES], *out[IIR_BATCH_LANES];
+	t_iirbatchlanes v;
+	long l, poles, frames = e->vectorSize;
+
+	if ( IIR_BATCH_WHAT(status) != IIR_BATCH_OPEN )
+		return 0;
+
+	IIR_BATCH_BARRIER();
+	buf = w->buf;
+	poles = w->poles;
+	for ( l=0; l<IIR_BATCH_LANES; l++ ) {
+		in[l] = l < w->lanes ? w->slot[l]->in : NULL;
+		out[l] = l < w->lanes ? buf->out + l * frames : NULL;
+	}
+	if ( !ATOMIC_COMPARE_SWAP32(status, status - IIR_BATCH_OPEN + IIR_BATCH_TAKEN, &w->status) )
+		return 0;
+	status += IIR_BATCH_TAKEN - IIR_BATCH_OPEN;
+
+	v = buf->from;
+	iir_batch_run_lanes(&v, poles, frames, in, out);
+	memcpy(buf->x, v.x, sizeof(v.x));
+	memcpy(buf->y, v.y, sizeof(v.y));
+
+	//	the result is written before it is handed back
+	IIR_BATCH_BARRIER();
+	if ( !ATOMIC_COMPARE_SWAP32(status, status - IIR_BATCH_TAKEN + IIR_BATCH_DONE, &w->status) )
+		buf->held = 0;
+	return 1;
+}
+
+//	take and run open work items until there are none left
+static void iir_batch_drain(t_iirbatch *e)
+{
+	long i;
+
+	for ( i=0; i<e->workCount; i++ )
+		iir_batch_take(e, e->work + i);
+}
+
+static void *iir_batch_worker(t_iirbatch *e)
+{
+	long seen = 0;
+
+	for (;;) {
+		systhread_mutex_lock(e->wakeLock);
+		while ( e->generation == seen && !e->quit )
+			systhread_cond_wait(e->wake, e->wakeLock);
+		seen = e->generation;
+		systhread_mutex_unlock(e->wakeLock);
+
+		if ( e->quit )
+			break;
+
+		//	the work list is not replaced while this is counted
+		ATOMIC_INCREMENT(&e->draining);
+		if ( !e->resizing )
+			iir_batch_drain(e);
+		ATOMIC_DECREMENT(&e->draining);
+	}
+
+	systhread_exit(0);
+	return NULL;
+}
+
+//	A worker the audio thread gave up on is still filtering into one of the buffers.
+static int iir_batch_held(t_iirbatch *e)
+{
+	long i;
+
+	for ( i=0; e->bufs && i<e->alloc + e->threadsWanted; i++ ) {
+		if ( e->bufs[i].held )
+			return 1;
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Audio thread, with e->lock held: filter everything deposited since the last run, and return
+//	once it is all done.
+static void iir_batch_process(t_iirbatch *e)
+{
+	long open[IIR_MAX_POLES+1];		//	work item still taking lanes for each pole count
+	t_iirbatchlanes v;
+	long i, n, p, b, pending;
+	t_int32 run = ++e->run;
+	double deadline;
+
+	for ( p=0; p<=IIR_MAX_POLES; p++ )
+		open[p] = -1;
+
+	e->workCount = 0;
+	for ( i=0; i<e->count; i++ ) {
+		t_iirbatchslot *slot = e->slots[i];
+		t_iirbatchwork *w;
+
+		if ( !slot->deposited )
+			continue;
+		slot->deposited = 0;
+		p = slot->state->poles;
+
+		//	ramping, or a short vector: on its own, now
+		if ( slot->state->rampCountdown >= 0 || slot->frames != e->vectorSize ) {
+			for ( n=0; n<slot->frames; n++ )
+				slot->out[n] = iir_state_tick(slot->state, slot->in[n]);
+			continue;
+		}
+
+		if ( open[p] < 0 ) {
+			open[p] = e->workCount++;
+			e->work[open[p]].lanes = 0;
+			e->work[open[p]].poles = p;
+		}
+		w = e->work + open[p];
+		w->slot[w->lanes++] = slot;
+		if ( w->lanes == IIR_BATCH_LANES )
+			open[p] = -1;
+	}
+
+	//	without workers, or with nothing to share out, filter straight into the members
+	if ( !e->threads || e->workCount < 2 ) {
+		for ( i=0; i<e->workCount; i++ ) {
+			iir_batch_gather(e->work + i, &v);
+			iir_batch_run_direct(e->work + i, &v);
+		}
+		return;
+	}
+
+	//	each item gets a buffer no worker is still holding; there are enough for every item and
+	//	one held per worker
+	for ( i=0, b=0; i<e->workCount; i++, b++ ) {
+		while ( e->bufs[b].held )
+			b++;
+		e->work[i].buf = e->bufs + b;
+		iir_batch_gather(e->work + i, &e->bufs[b].from);
+	}
+
+	//	publish the work list only once it is complete
+	IIR_BATCH_BARRIER();
+	for ( i=0; i<e->workCount; i++ )
+		e->work[i].status = IIR_BATCH_STATUS(run, IIR_BATCH_OPEN);
+	IIR_BATCH_BARRIER();
+
+	systhread_mutex_lock(e->wakeLock);
+	e->generation++;
+	systhread_cond_broadcast(e->wake);
+	systhread_mutex_unlock(e->wakeLock);
+
+	iir_batch_drain(e);
+
+	//	wait a little for the groups on other threads
+	deadline = iir_autotune_now() + IIR_BATCH_WAIT_SHARE * e->vectorSize / e->samplerate;
+	do {
+		IIR_BATCH_BARRIER();
+		for ( i=0, pending=0; i<e->workCount; i++ )
+			pending += IIR_BATCH_WHAT(e->work[i].status) == IIR_BATCH_TAKEN;
+	} while ( pending && iir_autotune_now() < deadline );
+
+	for ( i=0; i<e->workCount; i++ ) {
+		t_iirbatchwork *w = e->work + i;
+
+		//	a worker that has not finished keeps its buffer until it has, and its result is not used
+		if ( w->status == IIR_BATCH_STATUS(run, IIR_BATCH_TAKEN) ) {
+			w->buf->held = 1;
+			IIR_BATCH_BARRIER();
+			if ( ATOMIC_COMPARE_SWAP32(IIR_BATCH_STATUS(run, IIR_BATCH_TAKEN), IIR_BATCH_STATUS(run, IIR_BATCH_STOLEN), &w->status) ) {
+				v = w->buf->from;
+				iir_batch_run_direct(w, &v);
+				w->status = IIR_BATCH_CLOSED;
+				continue;
+			}
+			w->buf->held = 0;
+		}
+
+		IIR_BATCH_BARRIER();
+		for ( n=0; n<w->lanes; n++ )
+			memcpy(w->slot[n]->out, w->buf->out + n * e->vectorSize, e->vectorSize * sizeof(double));
+		iir_batch_scatter(w, w->buf->x, w->buf->y);
+		w->status = IIR_BATCH_CLOSED;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Perform routine side: return the result for the last input in out and leave in for the
+//	engine. The lock is only ever held for an exchange, a run, or a short change on the main
+//	thread, so it is waited for.
+static void iir_batch_exchange(t_iirbatchslot *slot, t_iirbatch *e, const double *in, double *out, long frames)
+{
+	long n;
+
+	systhread_mutex_lock(e->lock);
+
+	if ( slot->engine != e || frames > slot->size ) {
+		//	left the engine while an old DSP chain was still running
+		systhread_mutex_unlock(e->lock);
+		for ( n=0; n<frames; n++ )
+			out[n] = 0.0;
+		return;
+	}
+
+	//	still holding input from the last vector: a new vector has started, so run the engine
+	if ( slot->deposited )
+		iir_batch_process(e);
+
+	for ( n=0; n<frames; n++ )
+		out[n] = n < slot->frames ? slot->out[n] : 0.0;
+
+	for ( n=0; n<frames; n++ )
+		slot->in[n] = in[n];
+	slot->frames = frames;
+	slot->deposited = 1;
+
+	systhread_mutex_unlock(e->lock);
+}
+
+//	Perform routine side: lock the engine between runs, to change a member's state while nothing
+//	filters it.
+static void iir_batch_lock(t_iirbatch *e)
+{
+	systhread_mutex_lock(e->lock);
+}
+
+//	Main thread: lock the engine once the workers it gave up on are done with their buffers, since
+//	they can still be reading member inputs, and no worker is looking through the work list. The
+//	lock is not held while waiting, so the perform routines carry on.
+static void iir_batch_lock_idle(t_iirbatch *e)
+{
+	for (;;) {
+		systhread_mutex_lock(e->lock);
+		if ( !iir_batch_held(e) && !e->draining )
+			return;
+		systhread_mutex_unlock(e->lock);
+		systhread_sleep(1);
+	}
+}
+
+static void iir_batch_unlock(t_iirbatch *e)
+{
+	systhread_mutex_unlock(e->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void iir_batch_stop_threads(t_iirbatch *e)
+{
+	unsigned int ret;
+	long t;
+
+	if ( !e->threads )
+		return;
+
+	systhread_mutex_lock(e->wakeLock);
+	e->quit = 1;
+	systhread_cond_broadcast(e->wake);
+	systhread_mutex_unlock(e->wakeLock);
+
+	for ( t=0; t<e->threads; t++ )
+		systhread_join(e->thread[t], &ret);
+
+	e->threads = 0;
+	e->quit = 0;
+}
+
+static void iir_batch_start_threads(t_iirbatch *e)
+{
+	for ( e->threads=0; e->threads<e->threadsWanted; e->threads++ ) {
+		if ( systhread_create((method)iir_batch_worker, e, 0, 0, 0, e->thread + e->threads) )
+			break;
+	}
+}
+
+//	Release the slot's buffers after it has left its engine.
+static void iir_batch_free_slot(t_iirbatchslot *slot)
+{
+	if (slot->in) sysmem_freeptr(slot->in);
+	if (slot->out) sysmem_freeptr(slot->out);
+	slot->in = slot->out = NULL;
+	slot->size = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Register a slot with the engine for this sample rate, vector size and number of worker threads
+//	besides the audio thread, creating the engine if needed. Instances that ask for different
+//	numbers of threads get different engines. Main thread only.
+static t_iirbatch *iir_batch_join(t_iirbatchslot *slot, t_iirstate *state, double samplerate, long vectorSize, long threads)
+{
+	t_iirbatch *e;
+
+	if ( threads > IIR_BATCH_MAX_THREADS )
+		threads = IIR_BATCH_MAX_THREADS;
+
+	//	buffers first; the slot is not registered anywhere yet, so nothing else reads them
+	if ( slot->size < vectorSize ) {
+		double *in = (double *)sysmem_newptr(vectorSize * sizeof(double));
+		double *out = (double *)sysmem_newptr(vectorSize * sizeof(double));
+
+		if ( !in || !out ) {
+			if (in) sysmem_freeptr(in);
+			if (out) sysmem_freeptr(out);
+			return NULL;
+		}
+		iir_batch_free_slot(slot);
+		slot->in = in;
+		slot->out = out;
+		slot->size = vectorSize;
+	}
+	slot->state = state;
+	slot->deposited = 0;
+	slot->frames = 0;
+
+	systhread_mutex_lock(iir_batch_listlock);
+
+	for ( e = iir_batches; e; e = e->next ) {
+		if ( e->samplerate == samplerate && e->vectorSize == vectorSize && e->threadsWanted == threads )
+			break;
+	}
+	if ( !e && (e = (t_iirbatch *)sysmem_newptrclear(sizeof(t_iirbatch))) ) {
+		e->samplerate = samplerate;
+		e->vectorSize = vectorSize;
+		e->threadsWanted = threads;
+		systhread_mutex_new(&e->lock, 0);
+		systhread_mutex_new(&e->wakeLock, 0);
+		systhread_cond_new(&e->wake, 0);
+		e->next = iir_batches;
+		iir_batches = e;
+	}
+	if ( !e ) {
+		systhread_mutex_unlock(iir_batch_listlock);
+		return NULL;
+	}
+
+	//	count and alloc cannot change without iir_batch_listlock, so the arrays are allocated
+	//	before the engine is locked and the perform routines are only held off for the swap
+	if ( e->count == e->alloc ) {
+		long alloc = e->alloc ? e->alloc * 2 : 16;
+		long bufs = threads ? alloc + threads : 0, i;
+		t_iirbatchslot **slots = (t_iirbatchslot **)sysmem_newptr(alloc * sizeof(t_iirbatchslot *));
+		t_iirbatchwork *work = (t_iirbatchwork *)sysmem_newptrclear(alloc * sizeof(t_iirbatchwork));
+		t_iirbatchbuf *buf = bufs ? (t_iirbatchbuf *)sysmem_newptrclear(bufs * sizeof(t_iirbatchbuf)) : NULL;
+		double *bufOut = bufs ? (double *)sysmem_newptr(bufs * IIR_BATCH_LANES * vectorSize * sizeof(double)) : NULL;
+		t_iirbatchslot **oldSlots = e->slots;
+		t_iirbatchwork *oldWork = e->work;
+		t_iirbatchbuf *oldBufs = e->bufs;
+		double *oldBufOut = e->bufOut;
+
+		if ( !slots || !work || (bufs && (!buf || !bufOut)) ) {
+			if (slots) sysmem_freeptr(slots);
+			if (work) sysmem_freeptr(work);
+			if (buf) sysmem_freeptr(buf);
+			if (bufOut) sysmem_freeptr(bufOut);
+			systhread_mutex_unlock(iir_batch_listlock);
+			return NULL;
+		}
+		for ( i=0; i<bufs; i++ )
+			buf[i].out = bufOut + i * IIR_BATCH_LANES * vectorSize;
+
+		e->resizing = 1;
+		IIR_BATCH_BARRIER();
+		iir_batch_lock_idle(e);
+		if ( oldSlots )
+			memcpy(slots, oldSlots, e->count * sizeof(t_iirbatchslot *));
+		e->slots = slots;
+		e->work = work;
+		e->bufs = buf;
+		e->bufOut = bufOut;
+		e->alloc = alloc;
+		e->resizing = 0;
+		systhread_mutex_unlock(e->lock);
+
+		if ( oldSlots ) {
+			sysmem_freeptr(oldSlots);
+			sysmem_freeptr(oldWork);
+		}
+		if ( oldBufs ) {
+			sysmem_freeptr(oldBufs);
+			sysmem_freeptr(oldBufOut);
+		}
+	}
+
+	//	an idle engine let its threads go
+	if ( !e->threads && e->threadsWanted )
+		iir_batch_start_threads(e);
+
+	systhread_mutex_lock(e->lock);
+	e->slots[e->count++] = slot;
+	slot->engine = e;
+	systhread_mutex_unlock(e->lock);
+
+	systhread_mutex_unlock(iir_batch_listlock);
+	return e;
+}
+
+//	Main thread only.
+static void iir_batch_leave(t_iirbatchslot *slot)
+{
+	t_iirbatch *e = slot->engine;
+	long i;
+
+	if ( !e )
+		return;
+
+	systhread_mutex_lock(iir_batch_listlock);
+
+	//	a worker left behind may still be reading the slot's input
+	iir_batch_lock_idle(e);
+
+	for ( i=0; i<e->count; i++ ) {
+		if ( e->slots[i] == slot ) {
+			e->slots[i] = e->slots[--e->count];
+			break;
+		}
+	}
+	slot->engine = NULL;
+
+	systhread_mutex_unlock(e->lock);
+
+	//	an idle engine keeps no threads around
+	if ( !e->count )
+		iir_batch_stop_threads(e);
+
+	systhread_mutex_unlock(iir_batch_listlock);
+}
+
+#endif
@@ -0,0 +1,439 @@
+/**
+*	Recursive filter kernel, shared by the iir~ external and the command line tools.
+*	This file has no Max dependencies.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#ifndef IIR_KERNEL_H
+#define IIR_KERNEL_H
+
+//	No fused multiply-adds, so the externals and the tools round alike. clang and MSVC take it from
+//	here; gcc needs -ffp-contract=off, which tools/Makefile passes.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(_MSC_VER)
+#pragma fp_contract (off)
+#endif
+
+#define IIR_MAX_POLES		64
+
+//	10 millisecond ramp time
+#define IIR_RAMP_SECONDS	0.01
+
+//	number of double arrays in a state block, see iir_state_attach()
+#define IIR_STATE_ARRAYS	8
+
+//	doubles in a state block with room for capacity poles
+#define IIR_STATE_SIZE(capacity)	( IIR_STATE_ARRAYS * (capacity) )
+
+typedef struct
+{
+	unsigned char poles;				//	number of poles
+	unsigned char capacity;				//	number of poles the state arrays have room for
+	double a0, *a, *b;					//	coefficients to apply to stream
+	double aTarget0, *aTarget, *bTarget;//	target coefficients if ramp time is greater than zero
+	double aDiff0, *aDiff, *bDiff;		//	difference between original and target
+	double *x, *y;						//	delayed input and output values
+	unsigned long rampSteps;			//	total number of steps to perform ramp
+	long rampCountdown;					//	position in crossfade between last and current corfficients, -1 ends count
+} t_iirstate;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Point the state arrays into one block of IIR_STATE_SIZE(capacity) doubles.
+static inline void iir_state_attach(t_iirstate *s, double *mem, unsigned char capacity)
+{
+	s->a = mem;
+	s->b = s->a + capacity;
+	s->aTarget = s->b + capacity;
+	s->bTarget = s->aTarget + capacity;
+	s->aDiff = s->bTarget + capacity;
+	s->bDiff = s->aDiff + capacity;
+	s->x = s->bDiff + capacity;
+	s->y = s->x + capacity;
+	s->capacity = capacity;
+}
+
+//	Copy the state into a larger block and switch to it. Nothing else may read or write the state
+//	while this runs; iir~ has its perform routine make the move at the start of a vector.
+static inline void iir_state_move(t_iirstate *s, double *mem, unsigned char capacity)
+{
+	double *from[IIR_STATE_ARRAYS] = { s->a, s->b, s->aTarget, s->bTarget, s->aDiff, s->bDiff, s->x, s->y };
+	unsigned long i, p;
+
+	for ( i=0; i<IIR_STATE_ARRAYS; i++ ) {
+		for ( p=0; p<s->capacity; p++ )
+			mem[i*capacity + p] = from[i][p];
+		for ( ; p<capacity; p++ )
+			mem[i*capacity + p] = 0.0;
+	}
+
+	iir_state_attach(s, mem, capacity);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static inline double iir_state_tick(t_iirstate *s, double x0)
+{
+	double rampDivisor = 0.0;
+
+	//	rampCountdown stays at -1 once the ramp is finished; the coefficients are left at target
+	if ( s->rampCountdown > 0 ) {
+		rampDivisor = (double)s->rampCountdown / (double) s->rampSteps;
+		s->a0 = (rampDivisor * s->aDiff0 ) + s->aTarget0;
+	}
+	else if ( s->rampCountdown == 0 ) {
+		s->a0 = s->aTarget0;	//	do we really need this special case?
+	}
+
+	double y0 = x0 * s->a0;
+
+	double* xEnd = s->x + s->poles;
+	double* xp = s->x;
+	double* ap = s->a;
+	double* aTp = s->aTarget;
+	double* aDp = s->aDiff;
+	double* yp = s->y;
+	double* bp = s->b;
+	double* bTp = s->bTarget;
+	double* bDp = s->bDiff;
+	while ( xp < xEnd ) {
+		if ( s->rampCountdown > 0 ) {
+			*ap = (rampDivisor * *aDp++) + *aTp++;
+			*bp = (rampDivisor * *bDp++) + *bTp++;
+		}
+		else if ( s->rampCountdown == 0 ) {
+			*ap = *aTp++;
+			*bp = *bTp++;
+		}
+
+		y0 += *xp++ * *ap++;
+		y0 += *yp++ * *bp++;
+	}
+
+	if ( s->rampCountdown > -1 ) {
+		s->rampCountdown--;
+	}
+
+	//	delay values one sample
+	if ( s->poles >= 2 ) {
+		xp = s->x + (s->poles-1);
+		double* xp1 = xp - 1;
+		yp = s->y + (s->poles-1);
+		double* yp1 = yp - 1;
+		while ( xp > s->x ) {
+			*xp-- = *xp1--;
+			*yp-- = *yp1--;
+		}
+	}
+
+	s->x[0] = x0;
+	s->y[0] = y0;
+
+	return y0;
+}
+
+//	Delay a block of n samples that was filtered some other way, so iir_state_tick() can carry on
+//	from where it ended.
+static inline void iir_state_history(t_iirstate *s, const double *in, const double *out, long n)
+{
+	long p, poles = s->poles;
+
+	//	iir_state_tick() keeps the newest sample even with no poles
+	if ( poles == 0 && n > 0 ) {
+		s->x[0] = in[n-1];
+		s->y[0] = out[n-1];
+		return;
+	}
+
+	//	keep the part of the old history that is still within reach
+	for ( p=poles-1; p>=n; p-- ) {
+		s->x[p] = s->x[p-n];
+		s->y[p] = s->y[p-n];
+	}
+	for ( ; p>=0; p-- ) {
+		s->x[p] = in[n-1-p];
+		s->y[p] = out[n-1-p];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Steady state block kernels, for when no ramp is running (rampCountdown < 0). They keep the
+//	history in a linear buffer for IIR_BLOCK_FRAMES samples at a time instead of shifting it every
+//	sample. in and out may be the same vector.
+
+#define IIR_BLOCK_FRAMES	64
+
+//	Linear history: xe[0 .. poles-1] and ye[0 .. poles-1] oldest to newest, the block goes after.
+static inline void iir_state_unpack(const t_iirstate *s, double *xe, double *ye)
+{
+	long p, poles = s->poles;
+
+	for ( p=0; p<poles; p++ ) {
+		xe[poles-1-p] = s->x[p];
+		ye[poles-1-p] = s->y[p];
+	}
+}
+
+//	Same arithmetic, in the same order, as iir_state_tick(), so the output is identical.
+static inline void iir_state_block(t_iirstate *s, const double *in, double *out, long n)
+{
+	double xe[IIR_MAX_POLES + IIR_BLOCK_FRAMES], ye[IIR_MAX_POLES + IIR_BLOCK_FRAMES];
+	const double *a = s->a, *b = s->b;
+	double a0 = s->a0;
+	long poles = s->poles, i, p;
+
+	while ( n > 0 ) {
+		long frames = n < IIR_BLOCK_FRAMES ? n : IIR_BLOCK_FRAMES;
+
+		iir_state_unpack(s, xe, ye);
+		for ( i=0; i<frames; i++ )
+			xe[poles+i] = in[i];
+
+		for ( i=0; i<frames; i++ ) {
+			const double *xp = xe + poles + i - 1, *yp = ye + poles + i - 1;
+			double y0 = xp[1] * a0;
+			for ( p=0; p<poles; p++ ) {
+				y0 += xp[-p] * a[p];
+				y0 += yp[-p] * b[p];
+			}
+			ye[poles+i] = y0;
+			out[i] = y0;
+		}
+
+		iir_state_history(s, xe + poles, ye + poles, frames);
+		in += frames;
+		out += frames;
+		n -= frames;
+	}
+}
+
+//	Look ahead: the feedforward half of every output in the block is computed first, one
+//	coefficient at a time across the whole block, which vectorizes; only the feedback half is left
+//	in the recursion. Sums in a different order than iir_state_tick().
+static inline void iir_state_split(t_iirstate *s, const double *in, double *out, long n)
+{
+	double xe[IIR_MAX_POLES + IIR_BLOCK_FRAMES], ye[IIR_MAX_POLES + IIR_BLOCK_FRAMES];
+	double ff[IIR_BLOCK_FRAMES];
+	const double *a = s->a, *b = s->b;
+	double a0 = s->a0;
+	long poles = s->poles, i, p;
+
+	while ( n > 0 ) {
+		long frames = n < IIR_BLOCK_FRAMES ? n : IIR_BLOCK_FRAMES;
+
+		iir_state_unpack(s, xe, ye);
+		for ( i=0; i<frames; i++ ) {
+			xe[poles+i] = in[i];
+			ff[i] = in[i] * a0;
+		}
+
+		for ( p=0; p<poles; p++ ) {
+			const double *xp = xe + poles - 1 - p;
+			double ap = a[p];
+			for ( i=0; i<frames; i++ )
+				ff[i] += xp[i] * ap;
+		}
+
+		for ( i=0; i<frames; i++ ) {
+			const double *yp = ye + poles + i - 1;
+			double y0 = ff[i];
+			for ( p=0; p<poles; p++ )
+				y0 += yp[-p] * b[p];
+			ye[poles+i] = y0;
+			out[i] = y0;
+		}
+
+		iir_state_history(s, xe + poles, ye + poles, frames);
+		in += frames;
+		out += frames;
+		n -= frames;
+	}
+}
+
+//	iir_state_block() with the sum over the poles split four ways, two poles a step, so each add
+//	does not wait on the one before. Sums in a different order than iir_state_tick().
+static inline void iir_state_unrolled(t_iirstate *s, const double *in, double *out, long n)
+{
+	double xe[IIR_MAX_POLES + IIR_BLOCK_FRAMES], ye[IIR_MAX_POLES + IIR_BLOCK_FRAMES];
+	const double *a = s->a, *b = s->b;
+	double a0 = s->a0;
+	long poles = s->poles, i, p;
+
+	while ( n > 0 ) {
+		long frames = n < IIR_BLOCK_FRAMES ? n : IIR_BLOCK_FRAMES;
+
+		iir_state_unpack(s, xe, ye);
+		for ( i=0; i<frames; i++ )
+			xe[poles+i] = in[i];
+
+		for ( i=0; i<frames; i++ ) {
+			const double *xp = xe + poles + i - 1, *yp = ye + poles + i - 1;
+			double acc0 = xp[1] * a0, acc1 = 0.0, acc2 = 0.0, acc3 = 0.0, y0;
+			for ( p=0; p+1<poles; p+=2 ) {
+				acc0 += xp[-p] * a[p];
+				acc1 += yp[-p] * b[p];
+				acc2 += xp[-p-1] * a[p+1];
+				acc3 += yp[-p-1] * b[p+1];
+			}
+			if ( p < poles ) {
+				acc0 += xp[-p] * a[p];
+				acc1 += yp[-p] * b[p];
+			}
+			y0 = (acc0 + acc2) + (acc1 + acc3);
+			ye[poles+i] = y0;
+			out[i] = y0;
+		}
+
+		iir_state_history(s, xe + poles, ye + poles, frames);
+		in += frames;
+		out += frames;
+		n -= frames;
+	}
+}
+
+//	Transposed direct form II. The history is folded into poles partial sums once per call, w[k]
+//	being what the samples so far add to the output k+1 samples on; each output is then a0 x + w[0]
+//	and one pass moves every partial sum along. Sums in a different order than iir_state_tick().
+static inline void iir_state_transposed(t_iirstate *s, const double *in, double *out, long n)
+{
+	double w[IIR_MAX_POLES + 1], xb[IIR_BLOCK_FRAMES];
+	const double *a = s->a, *b = s->b;
+	double a0 = s->a0, x0, y0;
+	long poles = s->poles, i, k, j;
+
+	for ( k=0; k<poles; k++ ) {
+		w[k] = 0.0;
+		for ( j=k; j<poles; j++ )
+			w[k] += a[j] * s->x[j-k] + b[j] * s->y[j-k];
+	}
+	w[poles] = 0.0;
+
+	while ( n > 0 ) {
+		long frames = n < IIR_BLOCK_FRAMES ? n : IIR_BLOCK_FRAMES;
+
+		for ( i=0; i<frames; i++ ) {
+			x0 = xb[i] = in[i];
+			y0 = x0 * a0 + w[0];
+			for ( k=0; k<poles; k++ )
+				w[k] = a[k] * x0 + b[k] * y0 + w[k+1];
+			out[i] = y0;
+		}
+
+		//	the direct form history, for the next call and for iir_state_tick()
+		iir_state_history(s, xb, out, frames);
+		in += frames;
+		out += frames;
+		n -= frames;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static inline void iir_state_clear_y(t_iirstate *s)
+{
+	double *yp = s->y;
+	double *yEnd = yp + s->capacity;
+	while ( yp < yEnd ) {
+		*yp++ = 0.0;
+	}
+}
+
+static inline void iir_state_clear_x(t_iirstate *s)
+{
+	double *xp = s->x;
+	double *xEnd = xp + s->capacity;
+	while ( xp < xEnd ) {
+		*xp++ = 0.0;
+	}
+}
+
+//	End a ramp at once, on the target coefficients.
+static inline void iir_state_settle(t_iirstate *s)
+{
+	unsigned long p;
+
+	s->a0 = s->aTarget0;
+	for ( p=0; p<s->poles; p++ ) {
+		s->a[p] = s->aTarget[p];
+		s->b[p] = s->bTarget[p];
+	}
+	s->rampCountdown = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static inline void iir_state_clear_coeffs(t_iirstate *s)
+{
+	//	"1.0" == pass data unchanged
+	//	"0.0" == silence
+	//	"0.1" == reduce overall by 20dB
+	s->a0 = s->aDiff0 = s->aTarget0 = 0.0;
+
+	for ( unsigned long p=0; p<s->capacity; p++ ) {
+		s->a[p] = s->b[p] = s->aTarget[p] = s->bTarget[p] = s->aDiff[p] = s->bDiff[p] = 0.0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Start a ramp toward a new coefficient list in "aabab" (inputOrder 0) or "aaabb" (inputOrder 1) order.
+//	Poles beyond the capacity of the state are ignored.
+static inline void iir_state_set_coeffs(t_iirstate *s, const double *list, long count, int inputOrder, unsigned long rampSteps)
+{
+	unsigned long p, poles;
+
+	poles = count/2; //	integer division, floor
+
+	s->rampSteps = rampSteps;
+	s->rampCountdown = s->rampSteps - 1;
+
+	//	Copy items in the input list to their proper locations.
+	s->aTarget0 = list[0];	//	the first is always the same no matter the order
+	s->aDiff0 = s->a0 - s->aTarget0;
+	if (inputOrder) {	//	aaabb
+		for (p=1; p<=poles && p<=s->capacity; p++) {
+			s->aTarget[p-1] = list[p];
+			s->bTarget[p-1] = list[poles+p];
+			s->aDiff[p-1] = s->a[p-1] - s->aTarget[p-1];
+			s->bDiff[p-1] = s->b[p-1] - s->bTarget[p-1];
+		}
+	}
+	else {				//	aabab
+		for (p=1; p<=poles && p<=s->capacity; p++) {
+			s->aTarget[p-1] = list[p*2-1];
+			s->bTarget[p-1] = list[p*2];
+			s->aDiff[p-1] = s->a[p-1] - s->aTarget[p-1];
+			s->bDiff[p-1] = s->b[p-1] - s->bTarget[p-1];
+		}
+	}
+
+	if ( poles != s->poles ) {
+		if ( poles >= s->capacity ) {
+			s->poles = s->capacity;
+		}
+		else {
+			if ( poles < s->poles ) {
+				double* ap = s->a + poles;
+				double* aEnd = s->a + s->poles;
+				double* bp = s->b + poles;
+				while ( ap < aEnd ) {
+					*ap++ = 0.0;
+					*bp++ = 0.0;
+				}
+			}
+
+			s->poles = poles;
+		}
+	}
+}
+
+#endif
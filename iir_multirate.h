@@ -0,0 +1,263 @@
+/**
+*	Decimator and interpolator for running an iir~ recursion at a fraction of the sample rate.
+*	This file has no Max dependencies.
+*
+*	The factor is a power of two, and each halving of the rate is a stage: a half-band lowpass made
+*	of two chains of first order allpass sections running at the lower rate, one on the even and
+*	one on the odd samples (polyphase IIR half-band, as in the elliptic designs of Valenzuela and
+*	Constantinides). Each section costs one multiply per low rate sample. A stage only has to keep
+*	aliases and images out of the band that is protected at the final rate, so the stages at the
+*	higher rates have a wide transition band and few sections, and only the last one is steep.
+*	Per full rate sample:
+*		if ( iir_multirate_down(mr, x, &low) )		//	every factor samples
+*			iir_multirate_push(mr, filter(low));
+*		y = iir_multirate_up(mr);
+*	Aliases and images that land below IIR_MULTIRATE_BAND of the low rate Nyquist frequency are
+*	more than 75 dB down, and a tone there comes back within 0.01 dB; tools/ratecheck measures both,
+*	along with the delay and what the resampling costs against filtering at the full rate. The
+*	phase is not linear, so the delay varies across the band, as it does in the recursion itself.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#ifndef IIR_MULTIRATE_H
+#define IIR_MULTIRATE_H
+
+#include <math.h>
+
+#define IIR_MULTIRATE_MAX_FACTOR	16
+#define IIR_MULTIRATE_MAX_STAGES	4		//	log2 of IIR_MULTIRATE_MAX_FACTOR
+#define IIR_MULTIRATE_MAX_SECTIONS	12		//	allpass sections per stage, both chains
+
+//	kept clear of aliases and images, as a fraction of the low rate Nyquist frequency
+#define IIR_MULTIRATE_BAND			0.8
+//	stopband attenuation each stage is designed for, in dB; the images of all the stages together
+//	still have to stay below 75 dB
+#define IIR_MULTIRATE_ATTENUATION	90.0
+
+#define IIR_MULTIRATE_PI			3.14159265358979323846
+
+typedef struct
+{
+	long sections;
+	double c[IIR_MULTIRATE_MAX_SECTIONS];	//	even on the chain of the later sample, odd on the other
+	double downX[IIR_MULTIRATE_MAX_SECTIONS], downY[IIR_MULTIRATE_MAX_SECTIONS];
+	double upX[IIR_MULTIRATE_MAX_SECTIONS], upY[IIR_MULTIRATE_MAX_SECTIONS];
+	double held;							//	first sample of a pair on the way down
+	int odd;								//	held is waiting for the second
+	double upOut[2];						//	pair of samples on the way up
+	int upLeft;								//	of upOut still to hand out
+} t_iirhalfband;
+
+typedef struct
+{
+	long factor;							//	1 passes everything through
+	long stages;
+	t_iirhalfband stage[IIR_MULTIRATE_MAX_STAGES];	//	first at the full rate
+	double low;								//	last low rate sample pushed
+} t_iirmultirate;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	The factor that will be used for a requested one: the power of two at or below it, from 1 to
+//	IIR_MULTIRATE_MAX_FACTOR.
+static inline long iir_multirate_factor(long factor)
+{
+	long f = 1;
+
+	while ( f*2 <= factor && f*2 <= IIR_MULTIRATE_MAX_FACTOR )
+		f *= 2;
+	return f;
+}
+
+static inline double iir_multirate_ipow(double q, long n)
+{
+	double r = 1.0;
+
+	while ( n-- > 0 )
+		r *= q;
+	return r;
+}
+
+//	Allpass coefficients for a half-band lowpass whose passband ends transition below a quarter of
+//	its sample rate and stopband starts as far above, attenuation dB down, from the elliptic
+//	filter's nome and the series for its zeros. Returns the number of sections.
+static inline long iir_multirate_design(double *c, double attenuation, double transition)
+{
+	double k, kk, e, e4, q, ap, a, t, num, den, ww, x;
+	long order, sections, s, i;
+	int sign;
+
+	k = tan((1.0 - 2.0*transition) * IIR_MULTIRATE_PI / 4.0);
+	k *= k;
+	kk = pow(1.0 - k*k, 0.25);
+	e = 0.5 * (1.0 - kk) / (1.0 + kk);
+	e4 = e*e*e*e;
+	q = e * (1.0 + e4 * (2.0 + e4 * (15.0 + 150.0 * e4)));
+
+	ap = pow(10.0, -attenuation / 10.0);
+	a = ap / (1.0 - ap);
+	order = (long)ceil(log(a*a / 16.0) / log(q));
+	order |= 1;
+	if ( order < 3 )
+		order = 3;
+	sections = (order - 1) / 2;
+	if ( sections > IIR_MULTIRATE_MAX_SECTIONS )
+		sections = IIR_MULTIRATE_MAX_SECTIONS;
+
+	for ( s=0; s<sections; s++ ) {
+		num = 0.0;
+		for ( i=0, sign=1; ; i++, sign=-sign ) {
+			t = iir_multirate_ipow(q, i*(i+1)) * sin((2*i+1) * (s+1) * IIR_MULTIRATE_PI / order) * sign;
+			num += t;
+			if ( fabs(t) < 1e-100 )
+				break;
+		}
+		den = 0.0;
+		for ( i=1, sign=-1; ; i++, sign=-sign ) {
+			t = iir_multirate_ipow(q, i*i) * cos(2*i * (s+1) * IIR_MULTIRATE_PI / order) * sign;
+			den += t;
+			if ( fabs(t) < 1e-100 )
+				break;
+		}
+		ww = num * pow(q, 0.25) / (den + 0.5);
+		ww *= ww;
+		x = sqrt((1.0 - ww*k) * (1.0 - ww/k)) / (1.0 + ww);
+		c[s] = (1.0 - x) / (1.0 + x);
+	}
+	return sections;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Stages for factor, which is made a power of two, and empty histories. Stage s, counting from 0
+//	at the full rate, only protects the final band, which is IIR_MULTIRATE_BAND/2 of the final rate
+//	or that over 2^(stages-s) of its own input rate.
+static inline void iir_multirate_init(t_iirmultirate *mr, long factor)
+{
+	long s, n;
+
+	mr->factor = iir_multirate_factor(factor);
+	for ( mr->stages=0; (1L << mr->stages) < mr->factor; mr->stages++ )
+		;
+
+	for ( s=0; s<mr->stages; s++ ) {
+		t_iirhalfband *st = mr->stage + s;
+		double band = IIR_MULTIRATE_BAND * 0.5 / (double)(1L << (mr->stages - s));
+
+		st->sections = iir_multirate_design(st->c, IIR_MULTIRATE_ATTENUATION, 0.25 - band);
+		for ( n=0; n<IIR_MULTIRATE_MAX_SECTIONS; n++ )
+			st->downX[n] = st->downY[n] = st->upX[n] = st->upY[n] = 0.0;
+		st->held = 0.0;
+		st->odd = 0;
+		st->upOut[0] = st->upOut[1] = 0.0;
+		st->upLeft = 0;
+	}
+	mr->low = 0.0;
+}
+
+//	One stage on the way down: the pair a, b (b the later) to one sample at half the rate.
+static inline double iir_halfband_down(t_iirhalfband *st, double a, double b)
+{
+	double even = b, odd = a, t;
+	long n;
+
+	for ( n=0; n+1<st->sections; n+=2 ) {
+		t = (even - st->downY[n]) * st->c[n] + st->downX[n];
+		st->downX[n] = even;
+		st->downY[n] = even = t;
+		t = (odd - st->downY[n+1]) * st->c[n+1] + st->downX[n+1];
+		st->downX[n+1] = odd;
+		st->downY[n+1] = odd = t;
+	}
+	if ( n < st->sections ) {
+		t = (even - st->downY[n]) * st->c[n] + st->downX[n];
+		st->downX[n] = even;
+		st->downY[n] = even = t;
+	}
+	return 0.5 * (even + odd);
+}
+
+//	One stage on the way up: one sample to a pair at twice the rate.
+static inline void iir_halfband_up(t_iirhalfband *st, double x)
+{
+	double even = x, odd = x, t;
+	long n;
+
+	for ( n=0; n+1<st->sections; n+=2 ) {
+		t = (even - st->upY[n]) * st->c[n] + st->upX[n];
+		st->upX[n] = even;
+		st->upY[n] = even = t;
+		t = (odd - st->upY[n+1]) * st->c[n+1] + st->upX[n+1];
+		st->upX[n+1] = odd;
+		st->upY[n+1] = odd = t;
+	}
+	if ( n < st->sections ) {
+		t = (even - st->upY[n]) * st->c[n] + st->upX[n];
+		st->upX[n] = even;
+		st->upY[n] = even = t;
+	}
+	st->upOut[0] = even;
+	st->upOut[1] = odd;
+	st->upLeft = 2;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Take one full rate sample. Returns 1 and sets *low when a low rate sample is due.
+static inline int iir_multirate_down(t_iirmultirate *mr, double x, double *low)
+{
+	long s;
+
+	for ( s=0; s<mr->stages; s++ ) {
+		t_iirhalfband *st = mr->stage + s;
+
+		if ( !st->odd ) {
+			st->held = x;
+			st->odd = 1;
+			return 0;
+		}
+		st->odd = 0;
+		x = iir_halfband_down(st, st->held, x);
+	}
+	*low = x;
+	return 1;
+}
+
+//	Hand back the filtered low rate sample.
+static inline void iir_multirate_push(t_iirmultirate *mr, double y)
+{
+	mr->low = y;
+}
+
+//	The full rate output sample, and on to the next one. A stage that has handed out its pair
+//	asks the one below it for the next sample, down to the last, which takes the low rate sample
+//	pushed since it last asked.
+static inline double iir_multirate_up(t_iirmultirate *mr)
+{
+	long s, empty;
+	double x;
+
+	for ( empty=0; empty<mr->stages && !mr->stage[empty].upLeft; empty++ )
+		;
+
+	//	refill from the lowest empty stage up
+	x = empty < mr->stages ? mr->stage[empty].upOut[2 - mr->stage[empty].upLeft--] : mr->low;
+	for ( s=empty-1; s>=0; s-- ) {
+		iir_halfband_up(mr->stage + s, x);
+		x = mr->stage[s].upOut[0];
+		mr->stage[s].upLeft = 1;
+	}
+	return x;
+}
+
+#endif
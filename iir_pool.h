@@ -0,0 +1,174 @@
+/**
+*	Process wide pool of iir~ state blocks.
+*
+*	Blocks come in size classes of 2, 4, 8 ... IIR_MAX_POLES poles and are carved out of large
+*	chunks, so instances created one after another (the voices of a poly~) sit next to each other
+*	in memory and a block is only as large as the filter that uses it. Chunks are about the same
+*	number of bytes in every class, so a class holds fewer blocks the larger they are, and a class
+*	nobody uses keeps one chunk so creating and deleting a single instance does not go to the system
+*	each time.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#ifndef IIR_POOL_H
+#define IIR_POOL_H
+
+#include "ext.h"
+#include "ext_systhread.h"
+#include "iir_kernel.h"
+
+//	2, 4, 8, 16, 32 and 64 poles
+#define IIR_POOL_CLASSES		6
+#define IIR_POOL_MIN_POLES		2
+#define IIR_POOL_CHUNK_BYTES	16384	//	of blocks, at least one block
+#define IIR_POOL_ALIGN			64		//	cache line
+
+//	orders the writes to a block before the store that hands it to another thread
+#ifdef WIN_VERSION
+#define IIR_POOL_BARRIER()		MemoryBarrier()
+#else
+#define IIR_POOL_BARRIER()		__sync_synchronize()
+#endif
+
+typedef struct _iirchunk
+{
+	struct _iirchunk *next;
+	void *mem;							//	as returned by sysmem_newptr(), blocks start aligned after it
+} t_iirchunk;
+
+typedef struct
+{
+	t_iirchunk *chunks;
+	void *freeList;						//	free blocks, linked through their first word
+	long live;							//	blocks handed out
+} t_iirpoolclass;
+
+static t_iirpoolclass iir_pool[IIR_POOL_CLASSES];
+static t_systhread_mutex iir_pool_lock;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	call once from main()
+static void iir_pool_init(void)
+{
+	systhread_mutex_new(&iir_pool_lock, 0);
+}
+
+//	size class that holds at least poles, or -1 if there is none
+static int iir_pool_class(long poles)
+{
+	int c;
+	long capacity = IIR_POOL_MIN_POLES;
+
+	for ( c=0; c<IIR_POOL_CLASSES; c++, capacity *= 2 ) {
+		if ( poles <= capacity )
+			return c;
+	}
+	return -1;
+}
+
+static unsigned char iir_pool_capacity(int c)
+{
+	return IIR_POOL_MIN_POLES << c;
+}
+
+static size_t iir_pool_block_size(int c)
+{
+	return IIR_STATE_SIZE(iir_pool_capacity(c)) * sizeof(double);
+}
+
+static long iir_pool_chunk_blocks(int c)
+{
+	long blocks = IIR_POOL_CHUNK_BYTES / iir_pool_block_size(c);
+	return blocks ? blocks : 1;
+}
+
+//	With iir_pool_lock held. Thread a chunk's blocks onto the free list so they are handed out in
+//	address order.
+static void iir_pool_thread(int c, t_iirchunk *chunk)
+{
+	t_iirpoolclass *pc = iir_pool + c;
+	size_t blockSize = iir_pool_block_size(c);
+	char *first = (char *)(((uintptr_t)chunk->mem + IIR_POOL_ALIGN - 1) & ~(uintptr_t)(IIR_POOL_ALIGN - 1));
+	long i;
+
+	for ( i = iir_pool_chunk_blocks(c)-1; i >= 0; i-- ) {
+		void *b = first + i * blockSize;
+		*(void **)b = pc->freeList;
+		pc->freeList = b;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Returns a block of IIR_STATE_SIZE(iir_pool_capacity(c)) doubles, or NULL.
+static double *iir_pool_alloc(int c)
+{
+	t_iirpoolclass *pc = iir_pool + c;
+	void *block;
+
+	systhread_mutex_lock(iir_pool_lock);
+
+	if ( !pc->freeList ) {
+		t_iirchunk *chunk = (t_iirchunk *)sysmem_newptr(sizeof(t_iirchunk));
+		void *mem = sysmem_newptr(iir_pool_block_size(c) * iir_pool_chunk_blocks(c) + IIR_POOL_ALIGN);
+
+		if ( !chunk || !mem ) {
+			if (chunk) sysmem_freeptr(chunk);
+			if (mem) sysmem_freeptr(mem);
+			systhread_mutex_unlock(iir_pool_lock);
+			return NULL;
+		}
+		chunk->mem = mem;
+		chunk->next = pc->chunks;
+		pc->chunks = chunk;
+		iir_pool_thread(c, chunk);
+	}
+
+	block = pc->freeList;
+	pc->freeList = *(void **)block;
+	pc->live++;
+
+	systhread_mutex_unlock(iir_pool_lock);
+	return (double *)block;
+}
+
+static void iir_pool_free(int c, double *block)
+{
+	t_iirpoolclass *pc = iir_pool + c;
+
+	if ( !block )
+		return;
+
+	systhread_mutex_lock(iir_pool_lock);
+
+	*(void **)block = pc->freeList;
+	pc->freeList = block;
+
+	//	give the memory back once nobody uses this size class, all but one chunk for the next
+	if ( --pc->live == 0 && pc->chunks->next ) {
+		while ( pc->chunks->next ) {
+			t_iirchunk *next = pc->chunks->next->next;
+			sysmem_freeptr(pc->chunks->next->mem);
+			sysmem_freeptr(pc->chunks->next);
+			pc->chunks->next = next;
+		}
+		pc->freeList = NULL;
+		iir_pool_thread(c, pc->chunks);
+	}
+
+	systhread_mutex_unlock(iir_pool_lock);
+}
+
+#endif
@@ -0,0 +1,354 @@
+/**
+*	Recording of an iir~ instance to a trace file (see iir_trace.h).
+*
+*	The perform routine puts each input vector, and each clear as it does it, in the audio ring, a
+*	single producer, single consumer ring whose head and tail are only moved behind memory
+*	barriers. It never waits: it takes no lock for the audio ring, and the stop handshake is an
+*	atomic count. A vector that does not fit is dropped and leaves a gap in the trace times.
+*
+*	Coefficient lists arrive on the main or scheduler thread, which can wait, so they take
+*	controlLock and wait for room in the control ring rather than drop anything. A list is applied
+*	to the state and put in the ring under the lock. The first vector recorded puts the whole filter
+*	state in the control ring under the same lock, taken there with a trylock, so every list is in
+*	either the state or a record after it. Until the perform routine gets the lock, vectors are not
+*	recorded and the clock stays at 0. A writer thread merges the two rings into the file in time
+*	order.
+*
+*	Times come from a sample clock the perform routine advances after every vector, so a list is
+*	stamped with the first sample of the vector it will first be applied to. That is exact when
+*	messages are handled between vectors (overdrive with the scheduler in the audio interrupt);
+*	otherwise a list can take effect part way through the vector before the one it is stamped with.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#ifndef IIR_RECORD_H
+#define IIR_RECORD_H
+
+#include <stdio.h>
+
+#include "ext.h"
+#include "ext_atomic.h"
+#include "ext_systhread.h"
+#include "iir_trace.h"
+
+#define IIR_RECORD_AUDIO_BYTES		(1 << 22)	//	about 11 seconds of 44.1k in flight
+#define IIR_RECORD_CONTROL_BYTES	(1 << 18)
+#define IIR_RECORD_IDLE_MS			2			//	writer sleep when both rings are empty, and list wait for room
+
+typedef struct
+{
+	t_iirring audio;					//	perform routine to writer: vectors and the clears it does
+	t_iirring control;					//	lists, the state, and clears while nothing performs
+	t_systhread_mutex controlLock;		//	held while a control record goes in, and while the writer reads the clock
+	t_int32_atomic performing;			//	the perform routine is using the audio ring
+	volatile uint64_t clock;			//	samples since recording started
+	volatile char active;
+	volatile char needState;			//	the state record has still to be put
+	volatile char quit;					//	writer drains everything and exits
+	t_systhread thread;
+	FILE *file;
+	uint64_t blocks;					//	vectors written
+	volatile long droppedBlocks;
+	t_int32_atomic droppedControl;		//	clears the audio ring had no room for, lists too long for the control ring
+} t_iirrecorder;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static t_iirrecorder *iir_record_new(void)
+{
+	t_iirrecorder *rec = (t_iirrecorder *)sysmem_newptrclear(sizeof(t_iirrecorder));
+	char *audio, *control;
+
+	if (!rec)
+		return NULL;
+	audio = (char *)sysmem_newptr(IIR_RECORD_AUDIO_BYTES);
+	control = (char *)sysmem_newptr(IIR_RECORD_CONTROL_BYTES);
+	if (!audio || !control) {
+		if (audio) sysmem_freeptr(audio);
+		if (control) sysmem_freeptr(control);
+		sysmem_freeptr(rec);
+		return NULL;
+	}
+	iir_ring_init(&rec->audio, audio, IIR_RECORD_AUDIO_BYTES);
+	iir_ring_init(&rec->control, control, IIR_RECORD_CONTROL_BYTES);
+	systhread_mutex_new(&rec->controlLock, 0);
+	return rec;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Writer side. The header of the record at the tail of a ring; returns 0 if the ring is empty.
+static int iir_record_peek(t_iirring *r, t_iirtracerecord *head)
+{
+	if (r->head == r->tail)
+		return 0;
+	IIR_TRACE_BARRIER();
+	iir_ring_read(r, r->tail, head, sizeof(*head));
+	return 1;
+}
+
+//	Writer side. Write the record at the tail of a ring straight from the ring, in two pieces if it
+//	wraps around the end, and release it.
+static void iir_record_write(t_iirrecorder *rec, t_iirring *r, const t_iirtracerecord *head)
+{
+	uint32_t bytes = sizeof(*head) + head->count * sizeof(double);
+	uint32_t off = r->tail & (r->size - 1);
+	uint32_t first = bytes < r->size - off ? bytes : r->size - off;
+
+	fwrite(r->buf + off, 1, first, rec->file);
+	if (bytes > first)
+		fwrite(r->buf, 1, bytes - first, rec->file);
+	iir_ring_release(r, bytes);
+	if (head->type == IIR_TRACE_BLOCK)
+		rec->blocks++;
+}
+
+//	Write, in time order with control records first at equal times, every control record stamped
+//	at or before limit and every audio record stamped before it. A control record stamped limit
+//	can still arrive, and goes ahead of the audio records stamped limit, so those wait. Returns the
+//	number of records written.
+static long iir_record_drain(t_iirrecorder *rec, uint64_t limit)
+{
+	t_iirtracerecord audio, control;
+	int hasAudio, hasControl;
+	long written = 0;
+
+	for (;;) {
+		hasControl = iir_record_peek(&rec->control, &control) && control.time <= limit;
+		hasAudio = iir_record_peek(&rec->audio, &audio) && audio.time < limit;
+		if (hasControl && (!hasAudio || control.time <= audio.time))
+			iir_record_write(rec, &rec->control, &control);
+		else if (hasAudio)
+			iir_record_write(rec, &rec->audio, &audio);
+		else
+			break;
+		written++;
+	}
+	return written;
+}
+
+static void *iir_record_writer(t_iirrecorder *rec)
+{
+	uint64_t limit;
+	char quit;
+
+	for (;;) {
+		quit = rec->quit;
+		IIR_TRACE_BARRIER();
+
+		//	every control record stamped before limit is in the ring once the lock is free
+		if (quit)
+			limit = (uint64_t)-1;
+		else {
+			systhread_mutex_lock(rec->controlLock);
+			limit = rec->clock;
+			systhread_mutex_unlock(rec->controlLock);
+		}
+
+		if (!iir_record_drain(rec, limit)) {
+			if (quit)
+				break;
+			fflush(rec->file);
+			systhread_sleep(IIR_RECORD_IDLE_MS);
+		}
+	}
+
+	systhread_exit(0);
+	return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Main thread. Start a new trace in filepath, an absolute native path. Returns 0 on failure.
+static int iir_record_start(t_iirrecorder *rec, const char *filepath, double sampleRate, long vectorSize, int precision)
+{
+	t_iirtraceheader h;
+
+	if (!(rec->file = fopen(filepath, "wb")))
+		return 0;
+	iir_trace_header(&h, sampleRate, vectorSize, precision);
+	fwrite(&h, sizeof(h), 1, rec->file);
+
+	//	nothing else touches the rings while recording is off
+	iir_ring_init(&rec->audio, rec->audio.buf, rec->audio.size);
+	iir_ring_init(&rec->control, rec->control.buf, rec->control.size);
+	rec->clock = 0;
+	rec->blocks = 0;
+	rec->droppedBlocks = rec->droppedControl = 0;
+	rec->needState = 1;
+	rec->quit = 0;
+
+	if (systhread_create((method)iir_record_writer, rec, 0, 0, 0, &rec->thread)) {
+		fclose(rec->file);
+		rec->file = NULL;
+		return 0;
+	}
+
+	IIR_TRACE_BARRIER();
+	rec->active = 1;
+	return 1;
+}
+
+//	Main thread. Finish the trace; returns 0 if it could not all be written.
+static int iir_record_stop(t_iirrecorder *rec)
+{
+	unsigned int ret;
+	int ok;
+
+	if (!rec->file)
+		return 1;
+
+	//	once the count is 0 with active clear, the perform routine is done with the audio ring
+	rec->active = 0;
+	IIR_TRACE_BARRIER();
+	while (rec->performing)
+		systhread_sleep(1);
+
+	rec->quit = 1;
+	systhread_join(rec->thread, &ret);
+
+	ok = !ferror(rec->file);
+	ok &= !fclose(rec->file);
+	rec->file = NULL;
+	return ok;
+}
+
+static void iir_record_free(t_iirrecorder *rec)
+{
+	iir_record_stop(rec);
+	systhread_mutex_free(rec->controlLock);
+	sysmem_freeptr(rec->audio.buf);
+	sysmem_freeptr(rec->control.buf);
+	sysmem_freeptr(rec);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Perform routine. Returns 1, holding off iir_record_stop() until iir_record_leave(), if recording.
+static int iir_record_enter(t_iirrecorder *rec)
+{
+	if (!rec->active)
+		return 0;
+	ATOMIC_INCREMENT(&rec->performing);
+	if (rec->active)
+		return 1;
+	ATOMIC_DECREMENT(&rec->performing);
+	return 0;
+}
+
+static void iir_record_leave(t_iirrecorder *rec)
+{
+	ATOMIC_DECREMENT(&rec->performing);
+}
+
+//	Perform routine, entered. Put the state record if it is still due; returns 0 if it could not
+//	be put this time.
+static int iir_record_state(t_iirrecorder *rec, const t_iirstate *s)
+{
+	int ok;
+
+	if (!rec->needState)
+		return 1;
+	if (!s || systhread_mutex_trylock(rec->controlLock))
+		return 0;
+	if ((ok = iir_trace_put_state(&rec->control, rec->clock, s)))
+		rec->needState = 0;
+	systhread_mutex_unlock(rec->controlLock);
+	return ok;
+}
+
+//	Perform routine, before the vector is filtered, with the state it will be filtered from (NULL
+//	if it cannot be looked at now). Never waits.
+static void iir_record_block(t_iirrecorder *rec, const t_iirstate *s, const double *in, long n)
+{
+	if (!iir_record_enter(rec))
+		return;
+	if (iir_record_state(rec, s)) {
+		if (!iir_trace_put_block(&rec->audio, rec->clock, in, n))
+			rec->droppedBlocks++;
+		IIR_TRACE_BARRIER();
+		rec->clock += n;
+	}
+	iir_record_leave(rec);
+}
+
+static void iir_record_block_float(t_iirrecorder *rec, const t_iirstate *s, const float *in, long n)
+{
+	if (!iir_record_enter(rec))
+		return;
+	if (iir_record_state(rec, s)) {
+		if (!iir_trace_put_block_float(&rec->audio, rec->clock, in, n))
+			rec->droppedBlocks++;
+		IIR_TRACE_BARRIER();
+		rec->clock += n;
+	}
+	iir_record_leave(rec);
+}
+
+//	Perform routine, as it clears the delayed values at the start of a vector. Before the state
+//	record is put, the state will have the clear in it.
+static void iir_record_cleared(t_iirrecorder *rec)
+{
+	if (!iir_record_enter(rec))
+		return;
+	if (!rec->needState && !iir_trace_put_clear(&rec->audio, rec->clock))
+		ATOMIC_INCREMENT(&rec->droppedControl);
+	iir_record_leave(rec);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Main or scheduler thread. Take controlLock, waiting for the writer to make room for a record of
+//	count doubles, whether or not recording; the change the record is for is made with the lock
+//	held, so the state record has either both or neither. Returns 0, without the lock, for a record
+//	that can never fit.
+static int iir_record_lock_control(t_iirrecorder *rec, long count)
+{
+	uint32_t bytes;
+
+	if (count > (long)((rec->control.size - sizeof(t_iirtracerecord)) / sizeof(double))) {
+		ATOMIC_INCREMENT(&rec->droppedControl);
+		return 0;
+	}
+	bytes = sizeof(t_iirtracerecord) + count * sizeof(double);
+
+	systhread_mutex_lock(rec->controlLock);
+	while (rec->active && iir_ring_space(&rec->control) < bytes) {
+		systhread_mutex_unlock(rec->controlLock);
+		systhread_sleep(IIR_RECORD_IDLE_MS);
+		systhread_mutex_lock(rec->controlLock);
+	}
+	return 1;
+}
+
+static void iir_record_unlock_control(t_iirrecorder *rec)
+{
+	systhread_mutex_unlock(rec->controlLock);
+}
+
+//	With controlLock held, as a list is applied.
+static void iir_record_coeffs(t_iirrecorder *rec, const double *list, long count, int order, unsigned long rampSteps)
+{
+	if (rec->active)
+		iir_trace_put_coeffs(&rec->control, rec->clock, list, count, order, rampSteps);
+}
+
+//	Main thread, as it clears the delayed values while nothing performs.
+static void iir_record_clear(t_iirrecorder *rec)
+{
+	if (!iir_record_lock_control(rec, 0))
+		return;
+	if (rec->active)
+		iir_trace_put_clear(&rec->control, rec->clock);
+	iir_record_unlock_control(rec);
+}
+
+#endif
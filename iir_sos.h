@@ -0,0 +1,703 @@
+/**
+*	Second order section factoring and cascade kernel for iir~ coefficient lists.
+*	This file has no Max dependencies.
+*
+*	A list in iir~ order describes
+*		y[n] = a0 x[n] + a1 x[n-1] + ... + aP x[n-P] + b1 y[n-1] + ... + bP y[n-P]
+*	The roots of the numerator and denominator polynomials are found, paired into sections of at
+*	most two poles and two zeros, and checked by multiplying the sections back out. The all-zero
+*	numerators of lowpass and highpass designs, (1 + z^-1)^P and (1 - z^-1)^P, are taken as they
+*	are. Other roots are the eigenvalues of the companion matrix, refined against the polynomial in
+*	double-double arithmetic. A list that does not factor cleanly, or has a pole on or outside the
+*	unit circle, is left to the direct form; tools/soscheck runs this over a grid of cheb designs.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#ifndef IIR_SOS_H
+#define IIR_SOS_H
+
+#include <math.h>
+#include <string.h>
+#include "iir_kernel.h"
+
+#define IIR_SOS_MAX_SECTIONS	( (IIR_MAX_POLES+1)/2 )
+
+//	largest difference allowed between the list and the product of its sections,
+//	relative to the largest coefficient of each polynomial
+#define IIR_SOS_TOLERANCE		1e-7
+
+//	most refinement steps after the eigenvalue solve
+#define IIR_SOS_POLISH_STEPS	100
+#define IIR_SOS_TURN_SIN		1e-4
+#define IIR_SOS_TURN_COS		0.999999995
+
+typedef struct
+{
+	long count;							//	number of sections, 0 when not factored
+	//	section k: y = a0 x + a1 x[-1] + a2 x[-2] + b1 y[-1] + b2 y[-2]
+	double a0[IIR_SOS_MAX_SECTIONS], a1[IIR_SOS_MAX_SECTIONS], a2[IIR_SOS_MAX_SECTIONS];
+	double b1[IIR_SOS_MAX_SECTIONS], b2[IIR_SOS_MAX_SECTIONS];
+	//	transposed direct form II state
+	double s1[IIR_SOS_MAX_SECTIONS], s2[IIR_SOS_MAX_SECTIONS];
+} t_iirsos;
+
+typedef struct
+{
+	double re, im;
+} t_iircomplex;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Transposed direct form II, one section over the whole block at a time, in place.
+static inline void iir_sos_process(t_iirsos *sos, double *io, long n)
+{
+	long k, i;
+
+	for ( k=0; k<sos->count; k++ ) {
+		double a0 = sos->a0[k], a1 = sos->a1[k], a2 = sos->a2[k];
+		double b1 = sos->b1[k], b2 = sos->b2[k];
+		double s1 = sos->s1[k], s2 = sos->s2[k];
+
+		for ( i=0; i<n; i++ ) {
+			double x = io[i];
+			double y = a0*x + s1;
+			s1 = a1*x + b1*y + s2;
+			s2 = a2*x + b2*y;
+			io[i] = y;
+		}
+
+		sos->s1[k] = s1;
+		sos->s2[k] = s2;
+	}
+}
+
+static inline void iir_sos_clear(t_iirsos *sos)
+{
+	long k;
+
+	for ( k=0; k<IIR_SOS_MAX_SECTIONS; k++ )
+		sos->s1[k] = sos->s2[k] = 0.0;
+}
+
+//	Take up the sections in next at the start of a vector. With the same layout the section states
+//	carry on, otherwise the new sections start from silence. When sections were running and fade is
+//	not NULL, fade gets a copy of them to fade out of with iir_sos_process_fade(); returns 1 then.
+static inline int iir_sos_take(t_iirsos *sos, const t_iirsos *next, t_iirsos *fade)
+{
+	int fading = fade && sos->count && next->count;
+	long k;
+
+	if ( fading )
+		*fade = *sos;
+	if ( next->count != sos->count ) {
+		iir_sos_clear(sos);
+		sos->count = 0;
+	}
+	for ( k=0; k<next->count; k++ ) {
+		sos->a0[k] = next->a0[k];
+		sos->a1[k] = next->a1[k];
+		sos->a2[k] = next->a2[k];
+		sos->b1[k] = next->b1[k];
+		sos->b2[k] = next->b2[k];
+	}
+	sos->count = next->count;
+	return fading;
+}
+
+//	iir_sos_process() while fading from the sections in from, which run alongside, to those in sos:
+//	the output moves linearly from theirs to these over steps samples, left of which are to go.
+//	Returns what is left of the fade after the block.
+static inline long iir_sos_process_fade(t_iirsos *sos, t_iirsos *from, double *io, long n, long left, long steps)
+{
+	double old[64];
+	long i, frames;
+
+	while ( n > 0 && left > 0 ) {
+		frames = n < 64 ? n : 64;
+		memcpy(old, io, frames * sizeof(double));
+		iir_sos_process(from, old, frames);
+		iir_sos_process(sos, io, frames);
+		for ( i=0; i<frames && left>0; i++, left-- )
+			io[i] += (old[i] - io[i]) * ((double)left / steps);
+		io += frames;
+		n -= frames;
+	}
+	if ( n > 0 )
+		iir_sos_process(sos, io, n);
+	return left;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Roots of c[0] z^n + c[1] z^(n-1) + ... + c[n] as the eigenvalues of its companion matrix, by
+//	the shifted QR iteration on the balanced matrix. These are the exact roots of a polynomial very
+//	close to c, but roots packed as closely as the poles of a low cutoff move a long way for a
+//	small change in the coefficients, so iir_sos_polish() takes them the rest of the way.
+//	Returns 0 if the iteration does not settle.
+static int iir_sos_roots(const double *c, long n, t_iircomplex *root)
+{
+	double h[IIR_MAX_POLES][IIR_MAX_POLES];
+	double p, q, r, s, t, u, v, w, x, y, z, f, g, norm;
+	long i, j, k, l, m, nn, its, done;
+
+	if ( c[0] == 0.0 || n < 1 )
+		return 0;
+
+	//	companion matrix, already upper Hessenberg
+	for ( i=0; i<n; i++ ) {
+		for ( j=0; j<n; j++ )
+			h[i][j] = 0.0;
+		h[0][i] = -c[i+1] / c[0];
+		if ( i > 0 )
+			h[i][i-1] = 1.0;
+	}
+
+	//	balance rows against columns with powers of two, so nothing is lost to rounding
+	for ( done=0; !done; ) {
+		done = 1;
+		for ( i=0; i<n; i++ ) {
+			for ( j=0, r=0.0, s=0.0; j<n; j++ ) {
+				if ( j == i ) continue;
+				s += fabs(h[j][i]);
+				r += fabs(h[i][j]);
+			}
+			if ( s == 0.0 || r == 0.0 )
+				continue;
+			t = s + r;
+			for ( f=1.0, g=r/2.0; s < g; s *= 4.0 )
+				f *= 2.0;
+			for ( g=r*2.0; s > g; s /= 4.0 )
+				f /= 2.0;
+			if ( (s + r) / f < 0.95 * t ) {
+				done = 0;
+				for ( j=0; j<n; j++ ) {
+					h[i][j] /= f;
+					h[j][i] *= f;
+				}
+			}
+		}
+	}
+
+	for ( i=0, norm=0.0; i<n; i++ ) {
+		for ( j=(i ? i-1 : 0); j<n; j++ )
+			norm += fabs(h[i][j]);
+	}
+
+	//	deflate one root or a pair at a time from the bottom of the matrix
+	nn = n-1;
+	t = 0.0;
+	while ( nn >= 0 ) {
+		its = 0;
+		do {
+			//	look for a negligible subdiagonal element
+			for ( l=nn; l>=1; l-- ) {
+				s = fabs(h[l-1][l-1]) + fabs(h[l][l]);
+				if ( s == 0.0 )
+					s = norm;
+				if ( fabs(h[l][l-1]) + s == s ) {
+					h[l][l-1] = 0.0;
+					break;
+				}
+			}
+
+			x = h[nn][nn];
+			if ( l == nn ) {
+				root[nn].re = x + t;
+				root[nn--].im = 0.0;
+			}
+			else {
+				y = h[nn-1][nn-1];
+				w = h[nn][nn-1] * h[nn-1][nn];
+				if ( l == nn-1 ) {
+					//	two roots from the trailing 2x2 block
+					p = 0.5 * (y - x);
+					q = p*p + w;
+					z = sqrt(fabs(q));
+					x += t;
+					if ( q >= 0.0 ) {
+						z = p + (p < 0.0 ? -z : z);
+						root[nn-1].re = root[nn].re = x + z;
+						if ( z != 0.0 )
+							root[nn].re = x - w/z;
+						root[nn-1].im = root[nn].im = 0.0;
+					}
+					else {
+						root[nn-1].re = root[nn].re = x + p;
+						root[nn-1].im = z;
+						root[nn].im = -z;
+					}
+					nn -= 2;
+				}
+				else {
+					if ( its == 60 )
+						return 0;
+					if ( its == 10 || its == 20 ) {
+						//	exceptional shift
+						t += x;
+						for ( i=0; i<=nn; i++ )
+							h[i][i] -= x;
+						s = fabs(h[nn][nn-1]) + fabs(h[nn-1][nn-2]);
+						y = x = 0.75 * s;
+						w = -0.4375 * s * s;
+					}
+					its++;
+
+					//	double shift: find where two consecutive small subdiagonal elements start
+					for ( m=nn-2; m>=l; m-- ) {
+						z = h[m][m];
+						r = x - z;
+						s = y - z;
+						p = (r*s - w) / h[m+1][m] + h[m][m+1];
+						q = h[m+1][m+1] - z - r - s;
+						r = h[m+2][m+1];
+						s = fabs(p) + fabs(q) + fabs(r);
+						p /= s;
+						q /= s;
+						r /= s;
+						if ( m == l )
+							break;
+						u = fabs(h[m][m-1]) * (fabs(q) + fabs(r));
+						v = fabs(p) * (fabs(h[m-1][m-1]) + fabs(z) + fabs(h[m+1][m+1]));
+						if ( u + v == v )
+							break;
+					}
+					for ( i=m+2; i<=nn; i++ ) {
+						h[i][i-2] = 0.0;
+						if ( i != m+2 )
+							h[i][i-3] = 0.0;
+					}
+
+					//	QR step on rows and columns l to nn, chasing the bulge down
+					for ( k=m; k<=nn-1; k++ ) {
+						if ( k != m ) {
+							p = h[k][k-1];
+							q = h[k+1][k-1];
+							r = k != nn-1 ? h[k+2][k-1] : 0.0;
+							if ( (x = fabs(p) + fabs(q) + fabs(r)) != 0.0 ) {
+								p /= x;
+								q /= x;
+								r /= x;
+							}
+						}
+						s = sqrt(p*p + q*q + r*r);
+						if ( p < 0.0 )
+							s = -s;
+						if ( s == 0.0 )
+							continue;
+						if ( k == m ) {
+							if ( l != m )
+								h[k][k-1] = -h[k][k-1];
+						}
+						else
+							h[k][k-1] = -s * x;
+						p += s;
+						x = p / s;
+						y = q / s;
+						z = r / s;
+						q /= p;
+						r /= p;
+						for ( j=k; j<=nn; j++ ) {
+							p = h[k][j] + q * h[k+1][j];
+							if ( k != nn-1 ) {
+								p += r * h[k+2][j];
+								h[k+2][j] -= p * z;
+							}
+							h[k+1][j] -= p * y;
+							h[k][j] -= p * x;
+						}
+						for ( i=l; i<=(nn < k+3 ? nn : k+3); i++ ) {
+							p = x * h[i][k] + y * h[i][k+1];
+							if ( k != nn-1 ) {
+								p += z * h[i][k+2];
+								h[i][k+2] -= p * r;
+							}
+							h[i][k+1] -= p * q;
+							h[i][k] -= p;
+						}
+					}
+				}
+			}
+		} while ( l < nn-1 );
+	}
+	return 1;
+}
+
+//	Double-double arithmetic for iir_sos_polish(): a value is hi + lo with |lo| at most half an ulp
+//	of hi. The products split their factors (Dekker) rather than rely on a fused multiply-add.
+typedef struct
+{
+	double hi, lo;
+} t_iirsosdd;
+
+static inline t_iirsosdd iir_sos_dd_norm(double s, double e)
+{
+	t_iirsosdd r;
+
+	r.hi = s + e;
+	r.lo = e - (r.hi - s);
+	return r;
+}
+
+static inline t_iirsosdd iir_sos_dd_add(t_iirsosdd a, t_iirsosdd b)
+{
+	double s = a.hi + b.hi;
+	double v = s - a.hi;
+	double e = (a.hi - (s - v)) + (b.hi - v);
+
+	return iir_sos_dd_norm(s, e + a.lo + b.lo);
+}
+
+static inline t_iirsosdd iir_sos_dd_mul(t_iirsosdd a, double b)
+{
+	double p = a.hi * b, t, ah, al, bh, bl;
+
+	t = 134217729.0 * a.hi;
+	ah = t - (t - a.hi);
+	al = a.hi - ah;
+	t = 134217729.0 * b;
+	bh = t - (t - b);
+	bl = b - bh;
+	return iir_sos_dd_norm(p, ((ah*bh - p) + ah*bl + al*bh) + al*bl + a.lo*b);
+}
+
+//	c(z) / c'(z) for c[0] z^n + ... + c[n], with both evaluated in double-double by Horner's rule.
+//	In double the rounding in evaluating c near a cluster of roots swamps c itself.
+static t_iircomplex iir_sos_newton(const double *c, long n, t_iircomplex z)
+{
+	t_iirsosdd vRe = { c[0], 0.0 }, vIm = { 0.0, 0.0 }, dRe = { 0.0, 0.0 }, dIm = { 0.0, 0.0 }, t;
+	t_iirsosdd ci = { 0.0, 0.0 };
+	t_iircomplex p, d, q;
+	double den;
+	long i;
+
+	for ( i=1; i<=n; i++ ) {
+		//	d = d z + p
+		t = iir_sos_dd_add(iir_sos_dd_add(iir_sos_dd_mul(dRe, z.re), iir_sos_dd_mul(dIm, -z.im)), vRe);
+		dIm = iir_sos_dd_add(iir_sos_dd_add(iir_sos_dd_mul(dRe, z.im), iir_sos_dd_mul(dIm, z.re)), vIm);
+		dRe = t;
+		//	p = p z + c[i]
+		ci.hi = c[i];
+		t = iir_sos_dd_add(iir_sos_dd_add(iir_sos_dd_mul(vRe, z.re), iir_sos_dd_mul(vIm, -z.im)), ci);
+		vIm = iir_sos_dd_add(iir_sos_dd_mul(vRe, z.im), iir_sos_dd_mul(vIm, z.re));
+		vRe = t;
+	}
+
+	p.re = vRe.hi + vRe.lo;
+	p.im = vIm.hi + vIm.lo;
+	d.re = dRe.hi + dRe.lo;
+	d.im = dIm.hi + dIm.lo;
+	den = d.re*d.re + d.im*d.im;
+	if ( den == 0.0 ) {
+		q.re = q.im = 0.0;
+		return q;
+	}
+	q.re = (p.re*d.re + p.im*d.im) / den;
+	q.im = (p.im*d.re - p.re*d.im) / den;
+	return q;
+}
+
+//	Refine the eigenvalues by Aberth's simultaneous iteration, so that roots packed closer together
+//	than the eigenvalue solve can resolve (a low cutoff with many poles) settle on the polynomial's
+//	own roots. Each step is Newton's, with the pull of the other roots taken out.
+static void iir_sos_polish(const double *c, long n, t_iircomplex *root)
+{
+	t_iircomplex q, s, w, dz;
+	double den, step, size;
+	long i, j, its;
+
+	//	turn the roots off the real axis a little: the iteration keeps a set that is symmetric about
+	//	it symmetric, so could never split a pair into the two real roots they should have been
+	for ( i=0; i<n; i++ ) {
+		w = root[i];
+		root[i].re = w.re * IIR_SOS_TURN_COS - w.im * IIR_SOS_TURN_SIN;
+		root[i].im = w.re * IIR_SOS_TURN_SIN + w.im * IIR_SOS_TURN_COS;
+	}
+
+	for ( its=0; its<IIR_SOS_POLISH_STEPS; its++ ) {
+		step = 0.0;
+		for ( i=0; i<n; i++ ) {
+			q = iir_sos_newton(c, n, root[i]);
+			if ( q.re == 0.0 && q.im == 0.0 )
+				continue;
+
+			//	s = sum over the others of 1 / (root[i] - root[j])
+			s.re = s.im = 0.0;
+			for ( j=0; j<n; j++ ) {
+				if ( j == i ) continue;
+				dz.re = root[i].re - root[j].re;
+				dz.im = root[i].im - root[j].im;
+				den = dz.re*dz.re + dz.im*dz.im;
+				if ( den == 0.0 ) continue;
+				s.re += dz.re / den;
+				s.im -= dz.im / den;
+			}
+
+			//	w = q / (1 - q s)
+			dz.re = 1.0 - (q.re*s.re - q.im*s.im);
+			dz.im = -(q.re*s.im + q.im*s.re);
+			den = dz.re*dz.re + dz.im*dz.im;
+			if ( den == 0.0 ) continue;
+			w.re = (q.re*dz.re + q.im*dz.im) / den;
+			w.im = (q.im*dz.re - q.re*dz.im) / den;
+
+			root[i].re -= w.re;
+			root[i].im -= w.im;
+			size = hypot(root[i].re, root[i].im);
+			step = fmax(step, hypot(w.re, w.im) / (size > 1.0 ? size : 1.0));
+		}
+		if ( step < 1e-15 )
+			break;
+	}
+}
+
+//	True when c[0..n] is c[0] (1 + s z^-1)^n for s = 1 (zeros at -1, a lowpass), -1 (zeros at 1,
+//	a highpass) or 0 (all zeros at the origin). Their roots are exact, and far too clustered to
+//	find numerically.
+static int iir_sos_binomial(const double *c, long n, double s)
+{
+	double term = c[0], scale = 0.0;
+	long i;
+
+	for ( i=0; i<=n; i++ )
+		scale = fmax(scale, fabs(c[i]));
+	for ( i=0; i<=n; i++ ) {
+		if ( fabs(c[i] - term) > 1e-12 * scale )
+			return 0;
+		term *= s * (double)(n - i) / (double)(i + 1);
+	}
+	return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	A real polynomial of at most second order: 1 + c1 z^-1 + c2 z^-2, and the root it is nearest to.
+typedef struct
+{
+	double c1, c2;
+	t_iircomplex at;
+	int order;
+	int used;
+} t_iirsosfactor;
+
+//	Split roots into real factors: conjugate pairs, then real roots two at a time, nearest first.
+//	Each complex root is matched with the nearest conjugate of the others and the two are averaged
+//	into an exact pair. Returns the number of factors.
+static long iir_sos_factors(const t_iircomplex *root, long n, t_iirsosfactor *f)
+{
+	t_iircomplex real[IIR_MAX_POLES];
+	char paired[IIR_MAX_POLES];
+	double d, bestDist = 0.0, re, im;
+	long i, j, best, nReal = 0, count = 0;
+
+	for ( i=0; i<n; i++ )
+		paired[i] = 0;
+
+	for ( i=0; i<n; i++ ) {
+		if ( paired[i] )
+			continue;
+		paired[i] = 1;
+
+		for ( j=0, best=-1; j<n; j++ ) {
+			if ( paired[j] || (root[j].im > 0.0) == (root[i].im > 0.0) )
+				continue;
+			d = hypot(root[j].re - root[i].re, root[j].im + root[i].im);
+			if ( best < 0 || d < bestDist ) {
+				best = j;
+				bestDist = d;
+			}
+		}
+
+		//	a root nearer its own conjugate than any other root's is real
+		if ( best < 0 || fabs(root[i].im) <= bestDist ) {
+			real[nReal] = root[i];
+			real[nReal++].im = 0.0;
+			continue;
+		}
+		paired[best] = 1;
+
+		re = 0.5 * (root[i].re + root[best].re);
+		im = 0.5 * (fabs(root[i].im) + fabs(root[best].im));
+		f[count].c1 = -2.0 * re;
+		f[count].c2 = re*re + im*im;
+		f[count].at.re = re;
+		f[count].at.im = im;
+		f[count].order = 2;
+		f[count++].used = 0;
+	}
+
+	//	sort real roots so neighbours pair up
+	for ( i=1; i<nReal; i++ ) {
+		t_iircomplex r = real[i];
+		for ( j=i; j>0 && real[j-1].re > r.re; j-- )
+			real[j] = real[j-1];
+		real[j] = r;
+	}
+	for ( i=0; i+1<nReal; i+=2 ) {
+		f[count].c1 = -(real[i].re + real[i+1].re);
+		f[count].c2 = real[i].re * real[i+1].re;
+		f[count].at = fabs(real[i].re) > fabs(real[i+1].re) ? real[i] : real[i+1];
+		f[count].order = 2;
+		f[count++].used = 0;
+	}
+	if ( nReal & 1 ) {
+		f[count].c1 = -real[nReal-1].re;
+		f[count].c2 = 0.0;
+		f[count].at = real[nReal-1];
+		f[count].order = 1;
+		f[count++].used = 0;
+	}
+	return count;
+}
+
+//	Factors of (z - r)^n. Returns the number of factors.
+static long iir_sos_repeated(double r, long n, t_iirsosfactor *f)
+{
+	long count = 0;
+
+	for ( ; n > 0; n -= 2 ) {
+		f[count].c1 = n > 1 ? -2.0 * r : -r;
+		f[count].c2 = n > 1 ? r * r : 0.0;
+		f[count].at.re = r;
+		f[count].at.im = 0.0;
+		f[count].order = n > 1 ? 2 : 1;
+		f[count++].used = 0;
+	}
+	return count;
+}
+
+//	out[0..n] = product of the factors, in powers of z^-1
+static void iir_sos_expand(const t_iirsosfactor *f, long count, double *out, long n)
+{
+	long k, i;
+
+	for ( i=0; i<=n; i++ )
+		out[i] = 0.0;
+	out[0] = 1.0;
+
+	for ( k=0; k<count; k++ ) {
+		for ( i=n; i>=0; i-- ) {
+			double v = out[i];
+			if ( i >= 1 ) v += f[k].c1 * out[i-1];
+			if ( i >= 2 ) v += f[k].c2 * out[i-2];
+			out[i] = v;
+		}
+	}
+}
+
+//	True when the factors, times poly[0], multiply back out to poly[0..n].
+static int iir_sos_check(const double *poly, long n, const t_iirsosfactor *f, long count)
+{
+	double check[IIR_MAX_POLES+1], scale = 0.0, err = 0.0;
+	long i;
+
+	iir_sos_expand(f, count, check, n);
+	for ( i=0; i<=n; i++ ) {
+		scale = fmax(scale, fabs(poly[i]));
+		err = fmax(err, fabs(check[i]*poly[0] - poly[i]));
+	}
+	return err <= IIR_SOS_TOLERANCE * scale;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Factor a[0..poles] and b[1..poles] (b[0] unused) into sos. Returns 1 on success.
+static int iir_sos_factor(const double *a, const double *b, long poles, t_iirsos *sos)
+{
+	t_iircomplex zero[IIR_MAX_POLES], pole[IIR_MAX_POLES];
+	t_iirsosfactor zf[IIR_MAX_POLES], pf[IIR_MAX_POLES];
+	double num[IIR_MAX_POLES+1], den[IIR_MAX_POLES+1];
+	long nz, np, i, j, k, order[IIR_MAX_POLES];
+
+	sos->count = 0;
+	if ( poles < 1 || poles > IIR_MAX_POLES || a[0] == 0.0 )
+		return 0;
+
+	//	z^P times numerator and denominator
+	for ( i=0; i<=poles; i++ ) {
+		num[i] = a[i];
+		den[i] = i ? -b[i] : 1.0;
+	}
+
+	//	lowpass and highpass designs have every zero at -1 or 1
+	if ( iir_sos_binomial(num, poles, 1.0) )
+		nz = iir_sos_repeated(-1.0, poles, zf);
+	else if ( iir_sos_binomial(num, poles, -1.0) )
+		nz = iir_sos_repeated(1.0, poles, zf);
+	else if ( iir_sos_binomial(num, poles, 0.0) )
+		nz = iir_sos_repeated(0.0, poles, zf);
+	else if ( iir_sos_roots(num, poles, zero) ) {
+		iir_sos_polish(num, poles, zero);
+		nz = iir_sos_factors(zero, poles, zf);
+	}
+	else
+		return 0;
+
+	if ( !iir_sos_check(num, poles, zf, nz) || !iir_sos_roots(den, poles, pole) )
+		return 0;
+	iir_sos_polish(den, poles, pole);
+	np = iir_sos_factors(pole, poles, pf);
+	if ( !iir_sos_check(den, poles, pf, np) || nz != np )
+		return 0;
+
+	//	stable poles only
+	for ( i=0; i<np; i++ ) {
+		if ( hypot(pf[i].at.re, pf[i].at.im) >= 1.0 )
+			return 0;
+	}
+
+	//	pole factors closest to the unit circle first get their nearest zeros; those sections run last
+	for ( i=0; i<np; i++ )
+		order[i] = i;
+	for ( i=1; i<np; i++ ) {
+		long o = order[i];
+		double r = hypot(pf[o].at.re, pf[o].at.im);
+		for ( j=i; j>0 && hypot(pf[order[j-1]].at.re, pf[order[j-1]].at.im) < r; j-- )
+			order[j] = order[j-1];
+		order[j] = o;
+	}
+
+	for ( i=0; i<np; i++ ) {
+		t_iirsosfactor *p = pf + order[i];
+		long best = -1;
+		double bestDist = 0.0;
+
+		for ( j=0; j<nz; j++ ) {
+			double d;
+			if ( zf[j].used ) continue;
+			d = hypot(zf[j].at.re - p->at.re, zf[j].at.im - p->at.im);
+			//	a one pole section takes a one zero factor if there is one
+			if ( p->order == 1 && zf[j].order == 1 ) d -= 1e6;
+			if ( best < 0 || d < bestDist ) {
+				best = j;
+				bestDist = d;
+			}
+		}
+		zf[best].used = 1;
+
+		k = np-1-i;		//	highest Q last
+		sos->a0[k] = 1.0;
+		sos->a1[k] = zf[best].c1;
+		sos->a2[k] = zf[best].c2;
+		sos->b1[k] = -p->c1;
+		sos->b2[k] = -p->c2;
+	}
+
+	//	overall gain in the first section
+	sos->a0[0] *= num[0];
+	sos->a1[0] *= num[0];
+	sos->a2[0] *= num[0];
+
+	sos->count = np;
+	return 1;
+}
+
+#endif
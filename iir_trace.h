@@ -0,0 +1,277 @@
+/**
+*	Trace of what an iir~ was given: its input vectors and every coefficient list, in order, with
+*	sample clock timestamps, for replaying offline with tools/iirreplay. Also the single producer,
+*	single consumer ring the records pass through on their way to the file.
+*	This file has no Max dependencies.
+*
+*	A trace file is a t_iirtraceheader followed by records, each a t_iirtracerecord and count
+*	doubles, in native byte order:
+*		IIR_TRACE_BLOCK		an input vector of count samples starting at time
+*		IIR_TRACE_COEFFS	a list of count coefficients in order (0 aabab, 1 aaabb), ramped over
+*							rampSteps samples, arriving at time; count 0 for a list that was not
+*							all numbers, which zeroed the coefficients at once
+*		IIR_TRACE_CLEAR		the delayed outputs were cleared before the vector at time, no payload
+*		IIR_TRACE_STATE		the whole direct form state (t_iirstate) as the first vector recorded
+*							found it: coefficients, ramp and delayed values, see iir_trace_put_state()
+*	time counts input samples since recording started. A block that could not be recorded shows up
+*	as a gap in the times. Records before the state record were already applied to it.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#ifndef IIR_TRACE_H
+#define IIR_TRACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "iir_kernel.h"
+
+#ifdef WIN_VERSION
+#include <windows.h>
+#define IIR_TRACE_BARRIER()		MemoryBarrier()
+#else
+#define IIR_TRACE_BARRIER()		__sync_synchronize()
+#endif
+
+#define IIR_TRACE_MAGIC			"IIRTRACE"
+#define IIR_TRACE_VERSION		2
+#define IIR_TRACE_BYTE_ORDER	0x01020304
+
+enum
+{
+	IIR_TRACE_BLOCK = 1,
+	IIR_TRACE_COEFFS,
+	IIR_TRACE_CLEAR,
+	IIR_TRACE_STATE
+};
+
+//	an IIR_TRACE_STATE payload is these, then the IIR_STATE_ARRAYS arrays of capacity doubles each
+enum
+{
+	IIR_TRACE_STATE_POLES,
+	IIR_TRACE_STATE_CAPACITY,
+	IIR_TRACE_STATE_RAMP_STEPS,
+	IIR_TRACE_STATE_RAMP_COUNTDOWN,
+	IIR_TRACE_STATE_A0,
+	IIR_TRACE_STATE_A_TARGET0,
+	IIR_TRACE_STATE_A_DIFF0,
+	IIR_TRACE_STATE_SCALARS
+};
+
+typedef struct
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	byteOrder;
+	double		sampleRate;
+	uint32_t	vectorSize;				//	of the DSP chain when recording started
+	uint32_t	precision;				//	32 or 64 bit signal vectors
+} t_iirtraceheader;
+
+typedef struct
+{
+	uint32_t	type;
+	uint32_t	count;					//	doubles that follow
+	uint64_t	time;
+	uint32_t	order;					//	IIR_TRACE_COEFFS only
+	uint32_t	rampSteps;
+} t_iirtracerecord;
+
+static inline void iir_trace_header(t_iirtraceheader *h, double sampleRate, long vectorSize, int precision)
+{
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, IIR_TRACE_MAGIC, 8);
+	h->version		= IIR_TRACE_VERSION;
+	h->byteOrder	= IIR_TRACE_BYTE_ORDER;
+	h->sampleRate	= sampleRate;
+	h->vectorSize	= (uint32_t)vectorSize;
+	h->precision	= (uint32_t)precision;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Ring of size bytes, a power of two. head and tail run freely and wrap at 2^32; the producer only
+//	moves head, the consumer only tail, so neither ever waits for the other.
+typedef struct
+{
+	char *buf;
+	uint32_t size;
+	volatile uint32_t head;				//	end of the committed records
+	volatile uint32_t tail;				//	end of what has been consumed
+} t_iirring;
+
+static inline void iir_ring_init(t_iirring *r, char *mem, uint32_t size)
+{
+	r->buf = mem;
+	r->size = size;
+	r->head = r->tail = 0;
+}
+
+static inline void iir_ring_copy(t_iirring *r, uint32_t pos, const void *src, uint32_t n)
+{
+	uint32_t off = pos & (r->size - 1);
+	uint32_t first = n < r->size - off ? n : r->size - off;
+
+	memcpy(r->buf + off, src, first);
+	memcpy(r->buf, (const char *)src + first, n - first);
+}
+
+//	Producer: bytes available to write.
+static inline uint32_t iir_ring_space(const t_iirring *r)
+{
+	return r->size - (r->head - r->tail);
+}
+
+//	Producer: make the bytes written since head visible to the consumer.
+static inline void iir_ring_commit(t_iirring *r, uint32_t n)
+{
+	IIR_TRACE_BARRIER();
+	r->head += n;
+}
+
+//	Consumer: copy n bytes at pos out, across the end if need be.
+static inline void iir_ring_read(const t_iirring *r, uint32_t pos, void *dst, uint32_t n)
+{
+	uint32_t off = pos & (r->size - 1);
+	uint32_t first = n < r->size - off ? n : r->size - off;
+
+	memcpy(dst, r->buf + off, first);
+	memcpy((char *)dst + first, r->buf, n - first);
+}
+
+//	Consumer: done with n bytes.
+static inline void iir_ring_release(t_iirring *r, uint32_t n)
+{
+	IIR_TRACE_BARRIER();
+	r->tail += n;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Records into a ring. Each returns 0, writing nothing, if the ring has no room.
+
+static inline int iir_trace_put(t_iirring *r, const t_iirtracerecord *rec, const double *data)
+{
+	uint32_t bytes = sizeof(*rec) + rec->count * sizeof(double);
+
+	if ( iir_ring_space(r) < bytes )
+		return 0;
+	iir_ring_copy(r, r->head, rec, sizeof(*rec));
+	iir_ring_copy(r, r->head + sizeof(*rec), data, rec->count * sizeof(double));
+	iir_ring_commit(r, bytes);
+	return 1;
+}
+
+static inline int iir_trace_put_block(t_iirring *r, uint64_t time, const double *in, long n)
+{
+	t_iirtracerecord rec = { IIR_TRACE_BLOCK, (uint32_t)n, time, 0, 0 };
+	return iir_trace_put(r, &rec, in);
+}
+
+//	32-bit vectors are widened on the way in
+static inline int iir_trace_put_block_float(t_iirring *r, uint64_t time, const float *in, long n)
+{
+	t_iirtracerecord rec = { IIR_TRACE_BLOCK, (uint32_t)n, time, 0, 0 };
+	uint32_t bytes = sizeof(rec) + n * sizeof(double), pos;
+	double chunk[64];
+	long i, done;
+
+	if ( iir_ring_space(r) < bytes )
+		return 0;
+	iir_ring_copy(r, r->head, &rec, sizeof(rec));
+	pos = r->head + sizeof(rec);
+	for ( done=0; done<n; done+=64 ) {
+		long count = n - done < 64 ? n - done : 64;
+		for ( i=0; i<count; i++ )
+			chunk[i] = (double)in[done+i];
+		iir_ring_copy(r, pos, chunk, count * sizeof(double));
+		pos += count * sizeof(double);
+	}
+	iir_ring_commit(r, bytes);
+	return 1;
+}
+
+static inline int iir_trace_put_coeffs(t_iirring *r, uint64_t time, const double *list, long count, int order, unsigned long rampSteps)
+{
+	t_iirtracerecord rec = { IIR_TRACE_COEFFS, (uint32_t)count, time, (uint32_t)order, (uint32_t)rampSteps };
+	return iir_trace_put(r, &rec, list);
+}
+
+static inline int iir_trace_put_clear(t_iirring *r, uint64_t time)
+{
+	t_iirtracerecord rec = { IIR_TRACE_CLEAR, 0, time, 0, 0 };
+
+	if ( iir_ring_space(r) < sizeof(rec) )
+		return 0;
+	iir_ring_copy(r, r->head, &rec, sizeof(rec));
+	iir_ring_commit(r, sizeof(rec));
+	return 1;
+}
+
+//	The state arrays go in whole, as iir_state_attach() lays them out in one block.
+static inline int iir_trace_put_state(t_iirring *r, uint64_t time, const t_iirstate *s)
+{
+	uint32_t arrays = IIR_STATE_SIZE(s->capacity);
+	t_iirtracerecord rec = { IIR_TRACE_STATE, IIR_TRACE_STATE_SCALARS + arrays, time, 0, (uint32_t)s->rampSteps };
+	double scalars[IIR_TRACE_STATE_SCALARS];
+
+	if ( iir_ring_space(r) < sizeof(rec) + rec.count * sizeof(double) )
+		return 0;
+	scalars[IIR_TRACE_STATE_POLES]			= s->poles;
+	scalars[IIR_TRACE_STATE_CAPACITY]		= s->capacity;
+	scalars[IIR_TRACE_STATE_RAMP_STEPS]		= (double)s->rampSteps;
+	scalars[IIR_TRACE_STATE_RAMP_COUNTDOWN]	= (double)s->rampCountdown;
+	scalars[IIR_TRACE_STATE_A0]				= s->a0;
+	scalars[IIR_TRACE_STATE_A_TARGET0]		= s->aTarget0;
+	scalars[IIR_TRACE_STATE_A_DIFF0]		= s->aDiff0;
+
+	iir_ring_copy(r, r->head, &rec, sizeof(rec));
+	iir_ring_copy(r, r->head + sizeof(rec), scalars, sizeof(scalars));
+	iir_ring_copy(r, r->head + sizeof(rec) + sizeof(scalars), s->a, arrays * sizeof(double));
+	iir_ring_commit(r, sizeof(rec) + rec.count * sizeof(double));
+	return 1;
+}
+
+//	Reader: load a state record into s, attached with at least the recorded capacity; the arrays
+//	beyond it are cleared, as iir_state_move() leaves them. Returns 0 if the record does not fit s.
+static inline int iir_trace_get_state(const t_iirtracerecord *rec, const double *data, t_iirstate *s)
+{
+	double *to[IIR_STATE_ARRAYS] = { s->a, s->b, s->aTarget, s->bTarget, s->aDiff, s->bDiff, s->x, s->y };
+	unsigned long capacity, i, p;
+
+	if ( rec->count < IIR_TRACE_STATE_SCALARS )
+		return 0;
+	capacity = (unsigned long)data[IIR_TRACE_STATE_CAPACITY];
+	if ( capacity > s->capacity || data[IIR_TRACE_STATE_POLES] > capacity
+		|| rec->count != IIR_TRACE_STATE_SCALARS + IIR_STATE_SIZE(capacity) )
+		return 0;
+
+	s->poles			= (unsigned char)data[IIR_TRACE_STATE_POLES];
+	s->rampSteps		= (unsigned long)data[IIR_TRACE_STATE_RAMP_STEPS];
+	s->rampCountdown	= (long)data[IIR_TRACE_STATE_RAMP_COUNTDOWN];
+	s->a0				= data[IIR_TRACE_STATE_A0];
+	s->aTarget0			= data[IIR_TRACE_STATE_A_TARGET0];
+	s->aDiff0			= data[IIR_TRACE_STATE_A_DIFF0];
+
+	data += IIR_TRACE_STATE_SCALARS;
+	for ( i=0; i<IIR_STATE_ARRAYS; i++ ) {
+		for ( p=0; p<capacity; p++ )
+			to[i][p] = data[i*capacity + p];
+		for ( ; p<s->capacity; p++ )
+			to[i][p] = 0.0;
+	}
+	return 1;
+}
+
+#endif
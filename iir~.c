@@ -23,25 +23,89 @@
 #include "z_dsp.h"
 #include <math.h>
 
+#include "iir_kernel.h"		//	recursion kernel shared with the command line tools
+#include "iir_pool.h"			//	right sized state blocks shared by all instances
+#include "iir_batch.h"			//	cross-instance processing
+#include "iir_sos.h"			//	second order section cascade
+#include "iir_multirate.h"		//	decimated processing
+#include "iir_autotune.h"		//	kernel benchmark
+#include "iir_record.h"			//	input and coefficient traces
+
 void *iir_class;
 
-#define IIR_MAX_POLES		64
-#define IIR_COEF_MEM_SIZE	( IIR_MAX_POLES * sizeof(double) )
+//	kernel measurements for every configuration seen on this machine, loaded from and appended to
+//	IIR_PROFILE_FILE in the Max preferences folder
+#define IIR_PROFILE_FILE	"iir~ kernels.txt"
+static t_iirprofile *iir_profiles = NULL;
+static long iir_profileCount = 0, iir_profileAlloc = 0;
+static char iir_profilesLoaded = 0;
+static t_systhread_mutex iir_profileLock;
+
+//	how long the perform routine has to take up a grown state block before the main thread moves
+//	the state itself, for a perform routine that is not being called, such as a muted poly~ voice's
+#define IIR_GROW_WAIT_MS	50
 
-//	10 millisecond ramp time
-#define IIR_RAMP_SECONDS	0.01
+//	pushes a list onto listsIncoming without a lock
+#ifdef WIN_VERSION
+#define IIR_CAS_PTR(oldp, newp, p)	(InterlockedCompareExchangePointer((PVOID volatile *)(p), (newp), (oldp)) == (PVOID)(oldp))
+#else
+#define IIR_CAS_PTR(oldp, newp, p)	__sync_bool_compare_and_swap((p), (oldp), (newp))
+#endif
+
+//	coefficient list waiting to be applied
+typedef struct _iirlist
+{
+	struct _iirlist *next;
+	t_int32 seq;						//	arrival number
+	long count;							//	0 for a list that was not all numbers
+	double list[1];						//	count values
+} t_iirlist;
 
 typedef struct
 {
 	t_pxobject l_obj;
-	unsigned char poles;				//	number of poles
 	unsigned char inputOrder;			//	order of coefficients
-	double a0, *a, *b;					//	coefficients to apply to stream
-	double aTarget0, *aTarget, *bTarget;//	target coefficients if ramp time is greater than zero
-	double aDiff0, *aDiff, *bDiff;		//	difference between original and target
-	double *x, *y;						//	delayed input and output values
-	unsigned long rampSteps;			//	total number of steps to perform ramp
-	long rampCountdown;					//	position in crossfade between last and current corfficients, -1 ends count
+	double *mem;						//	pool block holding all of the state arrays
+	int memClass;						//	pool size class of mem
+	double *memNext;					//	larger block the state is moving to, NULL when not growing
+	int memNextClass;
+	double *volatile memPending;		//	memNext until the perform routine has moved the state into it
+	t_int32_atomic performing;			//	a perform routine is part way through a vector
+	volatile char memMoving;			//	the main thread is moving the state into memPending
+	void *growClock;					//	checks back on a memPending the perform routine has not taken
+	void *growQelem;					//	moves the state on the main thread when it has not
+	char growChecking;					//	growClock is set
+	t_iirstate state;					//	coefficients, ramp and delayed values
+	volatile char clearPending;			//	the perform routine clears the delayed outputs at its next vector
+	t_iirlist *lists;					//	lists waiting to be applied, in arrival order
+	t_iirlist *volatile listsIncoming;	//	lists from other threads that found listLock held, newest first
+	t_systhread_mutex listLock;			//	guards lists and coefficient changes; off the main thread only tried
+	t_int32_atomic listArrivals;		//	numbers lists as they arrive
+	t_int32_atomic listsInFlight;		//	numbered lists that are not applied or queued yet
+	void *listQelem;					//	applies the queue on the main thread
+	char batchMode;						//	filter in the shared batch engine instead of perform64
+	long batchThreads;					//	worker threads requested for the engine
+	t_iirbatchslot batchSlot;
+	char sosMode;						//	factor lists into second order sections
+	t_iirsos *sos;						//	sections in use by the perform routine, count 0 for direct form
+	t_iirsos *sosPending;				//	sections factored from the latest list
+	volatile char sosReady;				//	sosPending is waiting to be picked up
+	void *sosQelem;						//	factors the latest list on the main thread
+	t_systhread_mutex sosLock;			//	guards sosPending; the perform routine only tries it
+	t_iirsos *sosFade;					//	the sections being faded out of after a change
+	long sosFadeLeft, sosFadeSteps;		//	samples of the fade, at the rate the sections run
+	char sosRan;						//	the sections filtered the last vector
+	long decimate;						//	run the recursion at 1/decimate of the sample rate
+	t_iirmultirate *multirate;			//	allocated by the first "decimate", set up by the perform routine
+	char autotune;						//	pick the fastest kernel for each configuration
+	int kernelForced;					//	kernel set with the kernel message, -1 when automatic
+	volatile int kernel;				//	steady state kernel used by the perform routines
+	t_iirprofile tuned;					//	measurements kernel was chosen from, poles -1 when none
+	const char *tunedFrom;				//	"measured" or "profile"
+	void *tuneQelem;					//	runs iir_tune() on the main thread
+	int dspPrecision;					//	32 or 64 for the running DSP chain, 0 before DSP starts
+	long dspVectorSize;
+	t_iirrecorder *recorder;			//	allocated by the first "record", kept for the next
 } t_iir;
 
 void *iir_new(t_symbol *o, short argc, const t_atom *argv);
@@ -51,14 +115,38 @@ void iir_assist(t_iir *iir, void *b, long m, long a, char *s);
 void iir_aabab(t_iir *iir);
 void iir_aaabb(t_iir *iir);
 void iir_print(t_iir *iir);
+void iir_batch(t_iir *iir, long on, long threads);
+void iir_sos(t_iir *iir, long on);
+void iir_sos_update(t_iir *iir);
+void iir_sos_adopt(t_iir *iir);
+int iir_sos_begin(t_iir *iir);
+void iir_sos_run(t_iir *iir, double *io, long n);
+void iir_decimate(t_iir *iir, long factor);
+void iir_perform_decimated(t_iir *iir, const double *in, double *out, long sampleframes);
+void iir_autotune(t_iir *iir, long on);
+void iir_kernel(t_iir *iir, t_symbol *s, long argc, t_atom *argv);
+void iir_tune(t_iir *iir);
+int iir_profile_lookup(t_iirprofile *pr);
+void iir_profile_store(const t_iirprofile *pr);
+void iir_record(t_iir *iir, t_symbol *s, long argc, t_atom *argv);
 void iir_dsp(t_iir *iir, t_signal **sp, short *count);
 void iir_dsp64(t_iir *iir, t_object *dsp64, short *count, double samplerate, long maxvectorsize, long flags);
 t_int *iir_perform(t_int *w);
 void iir_perform64(t_iir *iir, t_object *dsp64, double **ins, long numins, double **outs, long numouts, long sampleframes, long flags, void *userparam);
-inline t_double iir_apply_coeffs(t_iir *iir, t_double x0);
+void iir_perform64_batch(t_iir *iir, t_object *dsp64, double **ins, long numins, double **outs, long numouts, long sampleframes, long flags, void *userparam);
+int iir_perform_enter(t_iir *iir);
+void iir_perform_leave(t_iir *iir);
+void iir_perform_begin(t_iir *iir);
 void iir_clearY(t_iir *x);
+void iir_clearY_now(t_iir *iir);
 void iir_accept_coeffs(t_iir *x, t_symbol *, short argc, t_atom *argv);
+void iir_list_drain(t_iir *iir);
 void iir_clear_all_coeffs(t_iir *iir);
+int iir_grow(t_iir *iir, long poles);
+int iir_grow_adopt(t_iir *iir);
+int iir_grow_finish(t_iir *iir);
+void iir_grow_check(t_iir *iir);
+void iir_grow_fallback(t_iir *iir);
 
 int C74_EXPORT main(void)
 {
@@ -71,8 +159,18 @@ int C74_EXPORT main(void)
 	class_addmethod(iir_class, (method)iir_aabab, "aabab", 0);
 	class_addmethod(iir_class, (method)iir_aaabb, "aaabb", 0);
 	class_addmethod(iir_class, (method)iir_print, "print", 0);
+	class_addmethod(iir_class, (method)iir_batch, "batch", A_LONG, A_DEFLONG, 0);
+	class_addmethod(iir_class, (method)iir_sos, "sos", A_LONG, 0);
+	class_addmethod(iir_class, (method)iir_decimate, "decimate", A_LONG, 0);
+	class_addmethod(iir_class, (method)iir_autotune, "autotune", A_LONG, 0);
+	class_addmethod(iir_class, (method)iir_kernel, "kernel", A_GIMME, 0);
+	class_addmethod(iir_class, (method)iir_record, "record", A_GIMME, 0);
 	class_addmethod(iir_class, (method)iir_accept_coeffs, "list", A_GIMME, 0);
 	
+	iir_pool_init();
+	iir_batch_init();
+	systhread_mutex_new(&iir_profileLock, 0);
+	
 	class_dspinit(iir_class);
 	class_register(CLASS_BOX, iir_class);
 	
@@ -99,34 +197,66 @@ void *iir_new(t_symbol *o, short argc, const t_atom *argv)
 		else
 			iir->inputOrder = 0;
 		
-		iir->poles = 0;
+		iir->state.poles = 0;
 
-		iir->rampSteps = 1;
-		iir->rampCountdown = -1;
+		iir->state.rampSteps = 1;
+		iir->state.rampCountdown = -1;
+		
+		iir->batchMode = 0;
+		iir->batchThreads = 0;
+		memset(&iir->batchSlot, 0, sizeof(t_iirbatchslot));
+		
+		iir->sosMode = 0;
+		iir->sos = iir->sosPending = iir->sosFade = NULL;	//	allocated by the first "sos 1"
+		iir->sosReady = 0;
+		iir->sosFadeLeft = iir->sosFadeSteps = 0;
+		iir->sosRan = 0;
+		systhread_mutex_new(&iir->sosLock, 0);
+		iir->sosQelem = qelem_new(iir, (method)iir_sos_update);
+		
+		iir->decimate = 1;
+		iir->multirate = NULL;
+		
+		iir->autotune = 0;
+		iir->kernelForced = -1;
+		iir->kernel = IIR_KERNEL_TICK;
+		iir->tuned.poles = -1;
+		iir->tunedFrom = "";
+		iir->dspPrecision = 0;
+		iir->dspVectorSize = 0;
+		
+		iir->recorder = NULL;
 		
-		//	now we need pointers for our new data
-		iir->a = (double *)sysmem_newptr(IIR_COEF_MEM_SIZE);
-		iir->b = (double *)sysmem_newptr(IIR_COEF_MEM_SIZE);
-		iir->aTarget = (double *)sysmem_newptr(IIR_COEF_MEM_SIZE);
-		iir->bTarget = (double *)sysmem_newptr(IIR_COEF_MEM_SIZE);
-		iir->aDiff = (double *)sysmem_newptr(IIR_COEF_MEM_SIZE);
-		iir->bDiff = (double *)sysmem_newptr(IIR_COEF_MEM_SIZE);
-		iir->x = (double *)sysmem_newptr(IIR_COEF_MEM_SIZE);
-		iir->y = (double *)sysmem_newptr(IIR_COEF_MEM_SIZE);
+		iir->clearPending = 0;
+		iir->lists = iir->listsIncoming = NULL;
+		systhread_mutex_new(&iir->listLock, 0);
+		iir->listArrivals = iir->listsInFlight = 0;
+		iir->listQelem = qelem_new(iir, (method)iir_list_drain);
+		iir->tuneQelem = qelem_new(iir, (method)iir_tune);
 		
-		if (!iir->a || !iir->b || !iir->aDiff || !iir->bDiff || !iir->aTarget || !iir->bTarget || !iir->x || !iir->y)
+		//	now we need pointers for our new data; start with the smallest block and grow
+		//	when a longer coefficient list arrives
+		iir->memClass = 0;
+		iir->mem = iir_pool_alloc(iir->memClass);
+		iir->memNext = iir->memPending = NULL;
+		iir->performing = 0;
+		iir->memMoving = 0;
+		iir->growClock = clock_new(iir, (method)iir_grow_check);
+		iir->growQelem = qelem_new(iir, (method)iir_grow_fallback);
+		iir->growChecking = 0;
+		
+		if (!iir->mem) {
 			object_error((t_object *)iir, "BAD INIT POINTER");
+			iir->state.a = iir->state.b = iir->state.x = iir->state.y = NULL;
+			return (iir);
+		}
 		
+		iir_state_attach(&iir->state, iir->mem, iir_pool_capacity(iir->memClass));
 		iir_clear_all_coeffs(iir);
 		
 		//	set delayed output to silence
-		double *xp = iir->x;
-		double *xEnd = xp + IIR_MAX_POLES;
-		double *yp = iir->y;
-		while ( xp < xEnd ) {
-			*xp++ = 0.0;
-			*yp++ = 0.0;
-		}
+		iir_state_clear_x(&iir->state);
+		iir_state_clear_y(&iir->state);
 	}
 
 	return (iir);
@@ -135,16 +265,43 @@ void *iir_new(t_symbol *o, short argc, const t_atom *argv)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void iir_free(t_iir *iir)
 {
-	if(iir->a) sysmem_freeptr(iir->a);
-	if(iir->b) sysmem_freeptr(iir->b);
-	if(iir->aTarget) sysmem_freeptr(iir->aTarget);
-	if(iir->bTarget) sysmem_freeptr(iir->bTarget);
-	if(iir->aDiff) sysmem_freeptr(iir->aDiff);
-	if(iir->bDiff) sysmem_freeptr(iir->bDiff);
-	if(iir->x) sysmem_freeptr(iir->x);
-	if(iir->y) sysmem_freeptr(iir->y);
-	
+	//	removed from the DSP chain first, so nothing reads the state blocks any more
 	dsp_free((t_pxobject *)iir);
+	
+	iir_batch_leave(&iir->batchSlot);
+	iir_batch_free_slot(&iir->batchSlot);
+	
+	//	the clock sets growQelem, so it goes first; freeing a qelem cancels it
+	clock_unset(iir->growClock);
+	object_free(iir->growClock);
+	qelem_free(iir->growQelem);
+	qelem_free(iir->sosQelem);
+	qelem_free(iir->listQelem);
+	qelem_free(iir->tuneQelem);
+	while (iir->lists) {
+		t_iirlist *next = iir->lists->next;
+		sysmem_freeptr(iir->lists);
+		iir->lists = next;
+	}
+	while (iir->listsIncoming) {
+		t_iirlist *next = iir->listsIncoming->next;
+		sysmem_freeptr(iir->listsIncoming);
+		iir->listsIncoming = next;
+	}
+	systhread_mutex_free(iir->listLock);
+	
+	iir_pool_free(iir->memClass, iir->mem);
+	if (iir->memNext)
+		iir_pool_free(iir->memNextClass, iir->memNext);
+	
+	if (iir->sos) sysmem_freeptr(iir->sos);
+	if (iir->sosPending) sysmem_freeptr(iir->sosPending);
+	if (iir->sosFade) sysmem_freeptr(iir->sosFade);
+	systhread_mutex_free(iir->sosLock);
+	
+	if (iir->multirate) sysmem_freeptr(iir->multirate);
+	
+	if (iir->recorder) iir_record_free(iir->recorder);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -172,30 +329,449 @@ void iir_aaabb(t_iir *iir)
 void iir_print(t_iir *iir)
 {
 	long p;
-	if (iir->a)
+	t_iirstate *s = &iir->state;
+	if (s->a)
 	{
-		object_post((t_object *)iir, "a[00] = % .15e", iir->a0);
-		for ( p=0; p < iir->poles; p++ )
-			object_post((t_object *)iir, "a[%02d] = % .15e   b[%02d] = % .15e", p+1, iir->a[p], p+1, iir->b[p]);
+		object_post((t_object *)iir, "a[00] = % .15e", s->a0);
+		for ( p=0; p < s->poles; p++ )
+			object_post((t_object *)iir, "a[%02d] = % .15e   b[%02d] = % .15e", p+1, s->a[p], p+1, s->b[p]);
 	}
 	else
 		object_post((t_object *)iir, "a[00] = 0.0");
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	batch <0|1> [worker threads]
+//	Takes effect when DSP is restarted. Batched instances are one signal vector late. Instances
+//	share an engine when they ask for the same number of threads, at the same sample rate and
+//	vector size.
+void iir_batch(t_iir *iir, long on, long threads)
+{
+	iir->batchMode = on != 0;
+	iir->batchThreads = threads < 0 ? 0 : (threads > IIR_BATCH_MAX_THREADS ? IIR_BATCH_MAX_THREADS : threads);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	sos <0|1>
+//	Factor every list into second order sections and filter with those instead of the direct form.
+//	Lists that cannot be factored, or are unstable, still go to the direct form. New sections take
+//	over at the start of a signal vector and the output fades to them from the old ones.
+void iir_sos(t_iir *iir, long on)
+{
+	if (on && !iir->sos) {
+		iir->sos = (t_iirsos *)sysmem_newptrclear(sizeof(t_iirsos));
+		iir->sosPending = (t_iirsos *)sysmem_newptrclear(sizeof(t_iirsos));
+		iir->sosFade = (t_iirsos *)sysmem_newptrclear(sizeof(t_iirsos));
+		if (!iir->sos || !iir->sosPending || !iir->sosFade) {
+			object_error((t_object *)iir, "could not allocate sections");
+			if (iir->sos) sysmem_freeptr(iir->sos);
+			if (iir->sosPending) sysmem_freeptr(iir->sosPending);
+			if (iir->sosFade) sysmem_freeptr(iir->sosFade);
+			iir->sos = iir->sosPending = iir->sosFade = NULL;
+			return;
+		}
+	}
+	
+	iir->sosMode = on != 0;
+	if (iir->sosMode)
+		iir_sos_update(iir);
+}
+
+//	Factor the current target coefficients and hand the sections to the perform routine.
+//	Runs on the main thread, root finding can take a while for long lists.
+void iir_sos_update(t_iir *iir)
+{
+	t_iirstate *s = &iir->state;
+	double a[IIR_MAX_POLES+1], b[IIR_MAX_POLES+1];
+	long p, poles = s->poles;
+	
+	if (!iir->sosMode || !iir->sos || !iir->mem)
+		return;
+	
+	//	a list can be applied on the scheduler thread meanwhile
+	systhread_mutex_lock(iir->listLock);
+	poles = s->poles;
+	a[0] = s->aTarget0;
+	b[0] = 0.0;
+	for (p=1; p<=poles; p++) {
+		a[p] = s->aTarget[p-1];
+		b[p] = s->bTarget[p-1];
+	}
+	systhread_mutex_unlock(iir->listLock);
+	
+	systhread_mutex_lock(iir->sosLock);
+	if (!iir_sos_factor(a, b, poles, iir->sosPending) && poles > 0)
+		object_warn((t_object *)iir, "list does not factor into stable sections, using direct form");
+	iir->sosReady = 1;
+	systhread_mutex_unlock(iir->sosLock);
+}
+
+//	Called by the perform routines at the start of a vector. Never waits for the lock.
+void iir_sos_adopt(t_iir *iir)
+{
+	if (!iir->sosReady || systhread_mutex_trylock(iir->sosLock))
+		return;
+	
+	//	the old sections keep running for the length of a coefficient ramp while the output fades
+	if (iir_sos_take(iir->sos, iir->sosPending, iir->sosFade))
+		iir->sosFadeLeft = iir->sosFadeSteps = sys_getsr() * IIR_RAMP_SECONDS / iir->decimate;
+	else
+		iir->sosFadeLeft = 0;
+	iir->sosReady = 0;
+	
+	systhread_mutex_unlock(iir->sosLock);
+}
+
+//	Perform routines, at the start of a vector; returns 1 if the sections filter it. The direct form
+//	ramp stands still while they do, so when they stop, for "sos 0" or a list that did not factor,
+//	the direct form is settled on its targets and starts from silence rather than from a stale ramp.
+int iir_sos_begin(t_iir *iir)
+{
+	int sections;
+	
+	if (iir->sosMode)
+		iir_sos_adopt(iir);
+	sections = iir->mem && iir->sosMode && iir->sos->count;
+	
+	if (iir->sosRan && !sections && iir->mem) {
+		iir_state_settle(&iir->state);
+		iir_state_clear_x(&iir->state);
+		iir_state_clear_y(&iir->state);
+	}
+	iir->sosRan = sections;
+	return sections;
+}
+
+//	Perform routines: the sections over a block, in place, fading from the old ones after a change.
+void iir_sos_run(t_iir *iir, double *io, long n)
+{
+	if (iir->sosFadeLeft > 0)
+		iir->sosFadeLeft = iir_sos_process_fade(iir->sos, iir->sosFade, io, n, iir->sosFadeLeft, iir->sosFadeSteps);
+	else
+		iir_sos_process(iir->sos, io, n);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	decimate <factor>
+//	Run the recursion at 1/factor of the sample rate, between cascaded half-band decimators and
+//	interpolators, for cutoffs far below Nyquist. Other factors round down to a power of two. The
+//	coefficients must be designed for the lower rate (see "decimate" in cheb). 1 turns it off. Not
+//	used in batch mode.
+void iir_decimate(t_iir *iir, long factor)
+{
+	factor = iir_multirate_factor(factor);
+	
+	if (factor > 1 && !iir->multirate) {
+		if (!(iir->multirate = (t_iirmultirate *)sysmem_newptrclear(sizeof(t_iirmultirate)))) {
+			object_error((t_object *)iir, "could not allocate the decimator");
+			return;
+		}
+		iir->multirate->factor = 1;
+	}
+	iir->decimate = factor;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	autotune <0|1>
+//	When DSP starts, and when the pole count changes, time each steady state kernel on the current
+//	coefficients and vector size and use the fastest. Results are kept per machine, precision, pole
+//	count and vector size in IIR_PROFILE_FILE, so each configuration is only measured once. The
+//	measurement runs from a qelem, never in the dsp method; the old kernel runs until it is done.
+void iir_autotune(t_iir *iir, long on)
+{
+	iir->autotune = on != 0;
+	qelem_set(iir->tuneQelem);
+}
+
+//	kernel [tick|block|split|unrolled|transposed|auto]
+//	Use a kernel instead of the one autotune picks, or go back to it. Without an argument, posts the
+//	kernel in use and the timings it was chosen from.
+void iir_kernel(t_iir *iir, t_symbol *s, long argc, t_atom *argv)
+{
+	const t_iirprofile *pr = &iir->tuned;
+	int k;
+	
+	if (argc > 0) {
+		t_symbol *name = atom_getsym(argv);
+		
+		if (name == gensym("auto"))
+			iir->kernelForced = -1;
+		else {
+			for (k=0; k<IIR_KERNEL_COUNT && name != gensym(iir_kernel_names[k]); k++)
+				;
+			if (k == IIR_KERNEL_COUNT) {
+				object_error((t_object *)iir, "kernel: expected tick, block, split, unrolled, transposed or auto");
+				return;
+			}
+			iir->kernelForced = k;
+			iir->kernel = k;
+		}
+		qelem_set(iir->tuneQelem);
+		return;
+	}
+	
+	if (pr->poles >= 0)
+		object_post((t_object *)iir, "kernel %s%s; %ld poles, %ld samples, %d-bit: tick %.2f, block %.2f, split %.2f, unrolled %.2f, transposed %.2f ns per sample (%s)",
+			iir_kernel_names[iir->kernel], iir->kernelForced >= 0 ? " (set)" : "", pr->poles, pr->vectorSize, pr->precision,
+			pr->nsPerSample[IIR_KERNEL_TICK], pr->nsPerSample[IIR_KERNEL_BLOCK], pr->nsPerSample[IIR_KERNEL_SPLIT],
+			pr->nsPerSample[IIR_KERNEL_UNROLLED], pr->nsPerSample[IIR_KERNEL_TRANSPOSED], iir->tunedFrom);
+	else
+		object_post((t_object *)iir, "kernel %s%s; not measured", iir_kernel_names[iir->kernel], iir->kernelForced >= 0 ? " (set)" : "");
+}
+
+//	Choose the kernel for the current pole count and DSP configuration. Main thread only, from
+//	tuneQelem; the benchmark takes a few milliseconds. It runs on a copy of the target coefficients,
+//	taken under listLock so the pole count and the state block hold still, and without the lock, so
+//	lists are not held up. A list that changes the pole count meanwhile tunes again.
+void iir_tune(t_iir *iir)
+{
+	double mem[IIR_STATE_SIZE(IIR_MAX_POLES)];
+	t_iirprofile pr;
+	t_iirstate copy;
+	long poles;
+	
+	if (iir->kernelForced >= 0)
+		iir->kernel = iir->kernelForced;
+	else if (!iir->autotune)
+		iir->kernel = IIR_KERNEL_TICK;
+	
+	if (!iir->autotune || !iir->mem || !iir->dspVectorSize)
+		return;
+	
+	systhread_mutex_lock(iir->listLock);
+	if ((poles = iir->state.poles)) {
+		iir_state_attach(&copy, mem, (unsigned char)poles);
+		copy.poles = (unsigned char)poles;
+		copy.aTarget0 = iir->state.aTarget0;
+		memcpy(copy.aTarget, iir->state.aTarget, poles * sizeof(double));
+		memcpy(copy.bTarget, iir->state.bTarget, poles * sizeof(double));
+	}
+	systhread_mutex_unlock(iir->listLock);
+	
+	if (!poles)
+		return;
+	
+	//	already measured for this configuration
+	if (iir->tuned.poles == poles && iir->tuned.vectorSize == iir->dspVectorSize && iir->tuned.precision == iir->dspPrecision)
+		pr = iir->tuned;
+	else {
+		iir_autotune_machine(pr.machine, sizeof(pr.machine));
+		pr.precision = iir->dspPrecision;
+		pr.poles = poles;
+		pr.vectorSize = iir->dspVectorSize;
+		
+		if (iir_profile_lookup(&pr))
+			iir->tunedFrom = "profile";
+		else if (iir_autotune_measure(&copy, iir->dspVectorSize, iir->dspPrecision, &pr)) {
+			iir_profile_store(&pr);
+			iir->tunedFrom = "measured";
+		}
+		else {
+			object_error((t_object *)iir, "autotune: out of memory");
+			return;
+		}
+		iir->tuned = pr;
+	}
+	
+	if (iir->kernelForced < 0)
+		iir->kernel = pr.kernel;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Profile file in the Max preferences folder; returns 0 if there is no preferences folder.
+static int iir_profile_path(char *filepath)
+{
+	short path;
+	
+	if (preferences_path(NULL, 1, &path))
+		return 0;
+	return !path_toabsolutesystempath(path, IIR_PROFILE_FILE, filepath);
+}
+
+static void iir_profile_add(const t_iirprofile *pr)
+{
+	if (iir_profileCount == iir_profileAlloc) {
+		long alloc = iir_profileAlloc ? iir_profileAlloc * 2 : 32;
+		t_iirprofile *grown = (t_iirprofile *)sysmem_newptr(alloc * sizeof(t_iirprofile));
+		
+		if (!grown)
+			return;
+		if (iir_profiles) {
+			memcpy(grown, iir_profiles, iir_profileCount * sizeof(t_iirprofile));
+			sysmem_freeptr(iir_profiles);
+		}
+		iir_profiles = grown;
+		iir_profileAlloc = alloc;
+	}
+	iir_profiles[iir_profileCount++] = *pr;
+}
+
+//	Fill in pr from the profile if its machine, precision, poles and vector size are there.
+int iir_profile_lookup(t_iirprofile *pr)
+{
+	char filepath[MAX_PATH_CHARS], line[256];
+	t_iirprofile entry;
+	FILE *f;
+	long i;
+	int found = 0;
+	
+	systhread_mutex_lock(iir_profileLock);
+	
+	if (!iir_profilesLoaded) {
+		iir_profilesLoaded = 1;
+		if (iir_profile_path(filepath) && (f = fopen(filepath, "r"))) {
+			while (fgets(line, sizeof(line), f)) {
+				if (iir_profile_parse(line, &entry))
+					iir_profile_add(&entry);
+			}
+			fclose(f);
+		}
+	}
+	
+	//	latest entry wins
+	for (i=iir_profileCount-1; i>=0 && !found; i--) {
+		t_iirprofile *e = iir_profiles + i;
+		if (e->precision == pr->precision && e->poles == pr->poles && e->vectorSize == pr->vectorSize && !strcmp(e->machine, pr->machine)) {
+			*pr = *e;
+			found = 1;
+		}
+	}
+	
+	systhread_mutex_unlock(iir_profileLock);
+	return found;
+}
+
+void iir_profile_store(const t_iirprofile *pr)
+{
+	char filepath[MAX_PATH_CHARS], line[256];
+	FILE *f;
+	
+	systhread_mutex_lock(iir_profileLock);
+	
+	iir_profile_add(pr);
+	if (iir_profile_path(filepath) && (f = fopen(filepath, "a"))) {
+		iir_profile_format(pr, line, sizeof(line));
+		fputs(line, f);
+		fclose(f);
+	}
+	
+	systhread_mutex_unlock(iir_profileLock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	record [file]
+//	Stream every input vector, coefficient list and clear to a trace file for tools/iirreplay. A
+//	name without a folder goes in the default folder. Without a file, stops recording.
+void iir_record(t_iir *iir, t_symbol *s, long argc, t_atom *argv)
+{
+	t_iirrecorder *rec = iir->recorder;
+	char filepath[MAX_PATH_CHARS];
+	const char *name;
+	short err;
+	
+	if (rec && rec->file) {
+		if (!iir_record_stop(rec))
+			object_error((t_object *)iir, "record: could not finish writing the trace");
+		object_post((t_object *)iir, "record: %llu vectors written, %ld vectors and %ld lists or clears dropped",
+			(unsigned long long)rec->blocks, rec->droppedBlocks, (long)rec->droppedControl);
+	}
+	
+	if (argc < 1)
+		return;
+	if (atom_gettype(argv) != A_SYM) {
+		object_error((t_object *)iir, "record: expected a file name");
+		return;
+	}
+	
+	name = atom_getsym(argv)->s_name;
+	if (strchr(name, '/') || strchr(name, ':') || strchr(name, '\\'))
+		err = path_nameconform(name, filepath, PATH_STYLE_NATIVE, PATH_TYPE_ABSOLUTE);
+	else
+		err = path_toabsolutesystempath(path_getdefault(), name, filepath);
+	if (err) {
+		object_error((t_object *)iir, "record: bad file name %s", name);
+		return;
+	}
+	
+	if (!rec && !(rec = iir->recorder = iir_record_new())) {
+		object_error((t_object *)iir, "record: out of memory");
+		return;
+	}
+	
+	//	the perform routine puts the state the trace starts from
+	if (!iir_record_start(rec, filepath, sys_getsr(), iir->dspVectorSize, iir->dspPrecision))
+		object_error((t_object *)iir, "record: could not write %s", filepath);
+	else
+		object_post((t_object *)iir, "record: writing %s", filepath);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void iir_dsp(t_iir *iir, t_signal **sp, short *count)
 {
 	iir_clearY(iir);
-	dsp_add(iir_perform, 6, sp[0]->s_vec, sp[3]->s_vec, iir, sp[1]->s_vec, sp[2]->s_vec, sp[0]->s_n);
+	iir_batch_leave(&iir->batchSlot);	//	batch mode is 64-bit only
+	
+	iir->dspPrecision = 32;
+	iir->dspVectorSize = sp[0]->s_n;
+	qelem_set(iir->tuneQelem);
+	
+	dsp_add(iir_perform, 4, sp[0]->s_vec, sp[1]->s_vec, iir, sp[0]->s_n);
 }
 
 void iir_dsp64(t_iir *iir, t_object *dsp64, short *count, double samplerate, long maxvectorsize, long flags)
 {
 	iir_clearY(iir);
+	
+	//	always leave first; the engine may be for another sample rate or vector size
+	iir_batch_leave(&iir->batchSlot);
+	
+	iir->dspPrecision = 64;
+	iir->dspVectorSize = maxvectorsize;
+	qelem_set(iir->tuneQelem);
+	
+	if (iir->batchMode && iir->mem) {
+		if (iir_batch_join(&iir->batchSlot, &iir->state, samplerate, maxvectorsize, iir->batchThreads)) {
+			dsp_add64(dsp64, (t_object*)iir, (t_perfroutine64)iir_perform64_batch, 0, NULL);
+			return;
+		}
+		object_error((t_object *)iir, "could not join the batch engine, processing on its own");
+	}
+	
 	dsp_add64(dsp64, (t_object*)iir, (t_perfroutine64)iir_perform64, 0, NULL);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Perform routines, first of all. Returns 1, holding off iir_grow_fallback() until
+//	iir_perform_leave(), unless the main thread is moving the state right now; the vector then
+//	leaves the state alone and outputs silence.
+int iir_perform_enter(t_iir *iir)
+{
+	ATOMIC_INCREMENT(&iir->performing);
+	if (!iir->memMoving)
+		return 1;
+	ATOMIC_DECREMENT(&iir->performing);
+	return 0;
+}
+
+void iir_perform_leave(t_iir *iir)
+{
+	ATOMIC_DECREMENT(&iir->performing);
+}
+
+//	Perform routines, at the start of a vector: take up a grown state block and a pending clear.
+void iir_perform_begin(t_iir *iir)
+{
+	if (iir->memPending && iir_grow_adopt(iir))
+		qelem_set(iir->listQelem);	//	lists waiting for the room go ahead
+	
+	if (iir->clearPending) {
+		iir->clearPending = 0;
+		iir_clearY_now(iir);
+		if (iir->recorder)
+			iir_record_cleared(iir->recorder);
+	}
+}
+
 t_int *iir_perform(t_int *w)
 {
 	// assign from parameters
@@ -203,14 +779,73 @@ t_int *iir_perform(t_int *w)
 	t_float *out = (t_float *) w[2];
 	t_iir *iir = (t_iir *) w[3];
 	long sampleframes = (long) w[4];
+	int sections;
+	
+	if (!iir_perform_enter(iir)) {
+		while (sampleframes--)
+			*out++ = 0.0f;
+		return (w+5);
+	}
+	
+	iir_perform_begin(iir);
 	
-	if (iir->l_obj.z_disabled)
+	if (iir->l_obj.z_disabled) {
+		iir_perform_leave(iir);
 		return (w+5);
+	}
+	
+	if (iir->recorder)
+		iir_record_block_float(iir->recorder, &iir->state, in, sampleframes);
+	
+	sections = iir_sos_begin(iir);
 	
 	// DSP loops
-	if (iir->a && iir->b && iir->x && iir->y) {
+	if (iir->mem && iir->decimate > 1 && iir->multirate) {
+		double xBuf[64], yBuf[64];
+		while (sampleframes > 0) {
+			long n = sampleframes < 64 ? sampleframes : 64, i;
+			for (i=0; i<n; i++)
+				xBuf[i] = (double)in[i];
+			iir_perform_decimated(iir, xBuf, yBuf, n);
+			for (i=0; i<n; i++)
+				out[i] = (t_float)yBuf[i];
+			in += n;
+			out += n;
+			sampleframes -= n;
+		}
+	}
+	else if (sections) {
+		double xBuf[64], yBuf[64];
+		while (sampleframes > 0) {
+			long n = sampleframes < 64 ? sampleframes : 64, i;
+			for (i=0; i<n; i++)
+				xBuf[i] = yBuf[i] = (double)in[i];
+			iir_sos_run(iir, yBuf, n);
+			iir_state_history(&iir->state, xBuf, yBuf, n);
+			for (i=0; i<n; i++)
+				out[i] = (t_float)yBuf[i];
+			in += n;
+			out += n;
+			sampleframes -= n;
+		}
+	}
+	else if (iir->mem && iir->kernel != IIR_KERNEL_TICK && iir->state.rampCountdown < 0) {
+		double buf[64];
+		while (sampleframes > 0) {
+			long n = sampleframes < 64 ? sampleframes : 64, i;
+			for (i=0; i<n; i++)
+				buf[i] = (double)in[i];
+			iir_kernel_run(&iir->state, iir->kernel, buf, buf, n);
+			for (i=0; i<n; i++)
+				out[i] = (t_float)buf[i];
+			in += n;
+			out += n;
+			sampleframes -= n;
+		}
+	}
+	else if (iir->mem) {
 		while (sampleframes--) {
-			*out++ = (t_float)iir_apply_coeffs(iir, (t_double)*in++);
+			*out++ = (t_float)iir_state_tick(&iir->state, (t_double)*in++);
 		}
 	}
 	else {	//	if pointers are no good...
@@ -218,6 +853,7 @@ t_int *iir_perform(t_int *w)
 			*out++ = *in++; //	...just copy input to output
 	}
 	
+	iir_perform_leave(iir);
 	return (w+5);
 }
 
@@ -226,182 +862,460 @@ void iir_perform64(t_iir *iir, t_object *dsp64, double **ins, long numins, doubl
 {
 	t_double *in = ins[0];
 	t_double *out = outs[0];
+	int sections;
+	
+	if (!iir_perform_enter(iir)) {
+		memset(out, 0, sampleframes * sizeof(double));
+		return;
+	}
+	
+	iir_perform_begin(iir);
 	
-	if (iir->l_obj.z_disabled)
+	if (iir->l_obj.z_disabled) {
+		iir_perform_leave(iir);
 		return;
+	}
+	
+	if (iir->recorder)
+		iir_record_block(iir->recorder, &iir->state, in, sampleframes);
+	
+	sections = iir_sos_begin(iir);
 	
 	// DSP loops
-	if (iir->a && iir->b && iir->x && iir->y) {
+	if (iir->mem && iir->decimate > 1 && iir->multirate) {
+		iir_perform_decimated(iir, in, out, sampleframes);
+	}
+	else if (sections) {
+		//	the direct form only needs the last samples of the block; in and out may be the same vector
+		double xTail[IIR_MAX_POLES];
+		long tail = sampleframes < iir->state.poles ? sampleframes : iir->state.poles;
+		memcpy(xTail, in + sampleframes - tail, tail * sizeof(double));
+		if (out != in)
+			memcpy(out, in, sampleframes * sizeof(double));
+		iir_sos_run(iir, out, sampleframes);
+		iir_state_history(&iir->state, xTail, out + sampleframes - tail, tail);
+	}
+	else if (iir->mem && iir->kernel != IIR_KERNEL_TICK && iir->state.rampCountdown < 0) {
+		iir_kernel_run(&iir->state, iir->kernel, in, out, sampleframes);
+	}
+	else if (iir->mem) {
 		while (sampleframes--) {
-			*out++ = iir_apply_coeffs(iir, *in++);
+			*out++ = iir_state_tick(&iir->state, *in++);
 		}
 	}
 	else {	//	if pointers are no good...
 		while (sampleframes--)
 			*out++ = *in++; //	...just copy input to output
 	}
+	
+	iir_perform_leave(iir);
 }
 
+//	Decimated: the recursion, sections or direct form, only sees every decimate'th sample of the
+//	anti-aliased input. in and out may be the same vector.
+void iir_perform_decimated(t_iir *iir, const double *in, double *out, long sampleframes)
+{
+	t_iirmultirate *mr = iir->multirate;
+	int sections = iir->sosMode && iir->sos->count;
+	double low, y;
+	long i;
+	
+	//	a new factor starts from silence
+	if (mr->factor != iir->decimate) {
+		iir_multirate_init(mr, iir->decimate);
+		iir_state_clear_y(&iir->state);
+		if (iir->sos)
+			iir_sos_clear(iir->sos);
+		iir->sosFadeLeft = 0;
+	}
+	
+	for (i=0; i<sampleframes; i++) {
+		if (iir_multirate_down(mr, in[i], &low)) {
+			if (sections) {
+				y = low;
+				iir_sos_run(iir, &y, 1);
+				iir_state_history(&iir->state, &low, &y, 1);
+			}
+			else
+				y = iir_state_tick(&iir->state, low);
+			iir_multirate_push(mr, y);
+		}
+		out[i] = iir_multirate_up(mr);
+	}
+}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////
-t_double iir_apply_coeffs(t_iir *iir, t_double x0)
+//	Batch mode: the output is the previous vector's result from the shared engine.
+void iir_perform64_batch(t_iir *iir, t_object *dsp64, double **ins, long numins, double **outs, long numouts, long sampleframes, long flags, void *userparam)
 {
-	double rampDivisor = 0.0;
+	t_iirbatch *engine = iir->batchSlot.engine;
 	
-	if ( iir->rampCountdown ) {
-		rampDivisor = (double)iir->rampCountdown / (double) iir->rampSteps;
-		iir->a0 = (rampDivisor * iir->aDiff0 ) + iir->aTarget0;
+	if (!iir_perform_enter(iir)) {
+		memset(outs[0], 0, sampleframes * sizeof(double));
+		return;
 	}
-	else if ( iir->rampCountdown == 0 ) {
-		iir->a0 = iir->aTarget0;	//	do we really need this special case?
+	
+	//	another member's perform routine may be running the engine; only change the state between runs
+	if (!engine)
+		iir_perform_begin(iir);
+	else if (iir->memPending || iir->clearPending) {
+		iir_batch_lock(engine);
+		iir_perform_begin(iir);
+		iir_batch_unlock(engine);
 	}
 	
-	double y0 = x0 * iir->a0;
-
-	double* xEnd = iir->x + iir->poles;
-	double* xp = iir->x;
-	double* ap = iir->a;
-	double* aTp = iir->aTarget;
-	double* aDp = iir->aDiff;
-	double* yp = iir->y;
-	double* bp = iir->b;
-	double* bTp = iir->bTarget;
-	double* bDp = iir->bDiff;
-	while ( xp < xEnd ) {
-		if ( iir->rampCountdown ) {
-			*ap = (rampDivisor * *aDp++) + *aTp++;
-			*bp = (rampDivisor * *bDp++) + *bTp++;
-		}
-		else if ( iir->rampCountdown == 0 ) {
-			*ap = *aTp++;
-			*bp = *bTp++;
-		}
-		
-		y0 += *xp++ * *ap++;
-		y0 += *yp++ * *bp++;
-	}
-	
-	if ( iir->rampCountdown > -1 ) {
-		iir->rampCountdown--;
-	}
-	
-	//	delay values one sample
-// 	for (p=iir->poles-1; p>0; p--) {
-// 		iir->x[p] = iir->x[p-1];
-// 		iir->y[p] = iir->y[p-1];
-// 	}
-	if ( iir->poles >= 2 ) {
-		xp = iir->x + (iir->poles-1);
-		double* xp1 = xp - 1;
-		yp = iir->y + (iir->poles-1);
-		double* yp1 = yp - 1;
-		while ( xp > iir->x ) {
-			*xp-- = *xp1--;
-			*yp-- = *yp1--;
+	if (iir->l_obj.z_disabled) {
+		iir_perform_leave(iir);
+		return;
+	}
+	
+	//	and the state is only looked at between runs
+	if (iir->recorder) {
+		if (!iir->recorder->needState || !engine)
+			iir_record_block(iir->recorder, &iir->state, ins[0], sampleframes);
+		else {
+			iir_batch_lock(engine);
+			iir_record_block(iir->recorder, &iir->state, ins[0], sampleframes);
+			iir_batch_unlock(engine);
 		}
 	}
 	
-	iir->x[0] = x0;
-	iir->y[0] = y0;
+	if (engine)
+		iir_batch_exchange(&iir->batchSlot, engine, ins[0], outs[0], sampleframes);
+	else
+		memset(outs[0], 0, sampleframes * sizeof(double));
 	
-	return y0;
+	iir_perform_leave(iir);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+//	With the DSP running the perform routine does the clear, and puts it in a trace, at the start of
+//	its next vector.
 void iir_clearY(t_iir *iir)
 {
-	double *yp = iir->y;
-	double *yEnd = yp + IIR_MAX_POLES;
-	while ( yp < yEnd ) {
-		*yp++ = 0.0;
+	iir->clearPending = 1;
+	if (!sys_getdspobjdspstate((t_object *)iir)) {
+		if (iir->recorder)
+			iir_record_clear(iir->recorder);
+		iir_clearY_now(iir);
 	}
 }
 
+void iir_clearY_now(t_iir *iir)
+{
+	if (iir->mem)
+		iir_state_clear_y(&iir->state);
+	if (iir->sos)
+		iir_sos_clear(iir->sos);
+	iir->sosFadeLeft = 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void iir_accept_coeffs (t_iir *iir, t_symbol *s, short argc, t_atom *argv)
+//	Main thread, with listLock held. Move the state to a pool block big enough for poles. The
+//	perform routine may be using the state, so the new block is handed to it in memPending and it
+//	makes the move at the start of its next vector; iir_grow_finish() then frees the old block.
+//	Returns 0 if there is no larger block.
+int iir_grow(t_iir *iir, long poles)
+{
+	int c = iir_pool_class(poles > IIR_MAX_POLES ? IIR_MAX_POLES : poles);
+	double *mem;
+
+	if (iir->memNext || c <= iir->memClass || !(mem = iir_pool_alloc(c)))
+		return 0;
+
+	iir->memNext = mem;
+	iir->memNextClass = c;
+	IIR_POOL_BARRIER();
+	iir->memPending = mem;
+
+	iir_grow_finish(iir);
+	return 1;
+}
+
+//	Perform routine, or main thread when nothing performs. Returns 1 if the state moved.
+int iir_grow_adopt(t_iir *iir)
+{
+	double *mem = iir->memPending;
+
+	if (!mem)
+		return 0;
+
+	IIR_POOL_BARRIER();
+	iir_state_move(&iir->state, mem, iir_pool_capacity(iir->memNextClass));
+	IIR_POOL_BARRIER();
+	iir->memPending = NULL;
+	return 1;
+}
+
+//	Main thread, with listLock held. Free the old block once the state has moved out of it;
+//	returns 0 while the perform routine has yet to move it.
+int iir_grow_finish(t_iir *iir)
 {
-	unsigned long i, p, poles;
+	if (!iir->memNext)
+		return 1;
+
+	if (iir->memPending) {
+		if (sys_getdspobjdspstate((t_object *)iir)) {
+			if (!iir->growChecking) {
+				iir->growChecking = 1;
+				clock_delay(iir->growClock, IIR_GROW_WAIT_MS);
+			}
+			return 0;
+		}
+
+		//	not performing; the batch engine may still hold a vector for it, so leave that too
+		iir_batch_leave(&iir->batchSlot);
+		iir_grow_adopt(iir);
+	}
+
+	IIR_POOL_BARRIER();
+	iir_pool_free(iir->memClass, iir->mem);
+	iir->mem = iir->memNext;
+	iir->memClass = iir->memNextClass;
+	iir->memNext = NULL;
+	return 1;
+}
+
+//	Clock, on whichever thread runs it.
+void iir_grow_check(t_iir *iir)
+{
+	qelem_set(iir->growQelem);
+}
+
+//	Main thread, IIR_GROW_WAIT_MS after a grown block was handed to the perform routine, which has
+//	not taken it up if it is not being called: move the state here, unless a perform routine is
+//	part way through a vector after all, then go on with the lists. Clears are still left to the
+//	perform routine.
+void iir_grow_fallback(t_iir *iir)
+{
+	t_iirbatch *engine;
+	
+	iir->growChecking = 0;
 	
+	systhread_mutex_lock(iir->listLock);
+	if (iir->memPending) {
+		//	the engine's threads filter the state too
+		if ((engine = iir->batchSlot.engine))
+			iir_batch_lock_idle(engine);
+		iir->memMoving = 1;
+		IIR_POOL_BARRIER();
+		if (!iir->performing)
+			iir_grow_adopt(iir);
+		IIR_POOL_BARRIER();
+		iir->memMoving = 0;
+		if (engine)
+			iir_batch_unlock(engine);
+	}
+	systhread_mutex_unlock(iir->listLock);
+	
+	//	sets the clock again if the state has still not moved
+	iir_list_drain(iir);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Lists arrive on the main and scheduler threads and are applied in the order they arrive. One
+//	that needs a larger state block, or arrives behind others, waits in iir->lists until the
+//	perform routine has moved the state, or the main thread has for a perform routine that is not
+//	being called; the queue is applied on the main thread.
+
+#define IIR_REDO_SOS	1
+#define IIR_REDO_TUNE	2
+
+static t_iirlist *iir_list_new(t_int32 seq, const double *list, long count)
+{
+	t_iirlist *node = (t_iirlist *)sysmem_newptr(sizeof(t_iirlist) + count * sizeof(double));
+
+	if (node) {
+		node->next = NULL;
+		node->seq = seq;
+		node->count = count;
+		memcpy(node->list, list, count * sizeof(double));
+	}
+	return node;
+}
+
+//	With listLock held. Usually at the end; a list that took the long way round from another
+//	thread goes ahead of later ones.
+static void iir_list_insert(t_iir *iir, t_iirlist *node)
+{
+	t_iirlist **at = &iir->lists;
+
+	while (*at && (t_int32)((t_uint32)node->seq - (t_uint32)(*at)->seq) > 0)
+		at = &(*at)->next;
+	node->next = *at;
+	*at = node;
+}
+
+//	With listLock held. The state has room for the list and is not on its way to a new block.
+static int iir_list_fits(t_iir *iir, long count)
+{
+	return !iir->memNext && (count/2 <= iir->state.capacity || iir->state.capacity >= IIR_MAX_POLES);
+}
+
+//	With listLock held. Start the ramp to a list, count 0 for one that was not all numbers, and
+//	return what has to be redone for the new coefficients.
+static long iir_list_apply(t_iir *iir, const double *list, long count)
+{
+	long poles = iir->state.poles, redo = 0;
+	unsigned long rampSteps = 0;
+	t_iirrecorder *rec = iir->recorder;
+
+	//	a trace gets the list under the lock its first state is taken under, so it has it once
+	if (rec && !iir_record_lock_control(rec, count))
+		rec = NULL;
+
+	//	Don't worry about ramping if coeff list is bad.
+	if (!count) {
+		iir->state.poles = 0;
+		iir->state.rampCountdown = 0;
+		iir_clear_all_coeffs(iir);
+	}
+	else {
+		//	the ramp runs at the rate the recursion runs at
+		rampSteps = sys_getsr() * IIR_RAMP_SECONDS / iir->decimate;
+		iir_state_set_coeffs(&iir->state, list, count, iir->inputOrder, rampSteps);
+	}
+
+	if (rec) {
+		iir_record_coeffs(rec, list, count, iir->inputOrder, rampSteps);
+		iir_record_unlock_control(rec);
+	}
+	if (!count)
+		return 0;
+
+	if (iir->sosMode)
+		redo |= IIR_REDO_SOS;
+	if (iir->autotune && iir->state.poles != poles)
+		redo |= IIR_REDO_TUNE;
+	return redo;
+}
+
+static void iir_list_redo(t_iir *iir, long redo)
+{
+	//	factor off the audio thread; until then the old sections keep running
+	if (redo & IIR_REDO_SOS) {
+		if (systhread_ismainthread())
+			iir_sos_update(iir);
+		else
+			qelem_set(iir->sosQelem);
+	}
+
+	//	a new pole count is a new configuration for autotune
+	if (redo & IIR_REDO_TUNE)
+		qelem_set(iir->tuneQelem);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void iir_accept_coeffs (t_iir *iir, t_symbol *s, short argc, t_atom *argv)
+{
+	double stackList[IIR_MAX_POLES*2+1];
+	double *list = stackList;
+	long i, count = argc, redo;
+	t_iirlist *node;
+	t_int32 seq;
+
+	if (!iir->mem || argc < 1)
+		return;
+
 	for(i=0; i<argc; i++) {
-		//	Don't worry about ramping if coeff list is bad.
 		if (argv[i].a_type != A_FLOAT) {
 			object_post((t_object *)iir, "WARNING: All list members must be of type float or double.");
-			iir->poles = 0;
-			iir->rampCountdown = 0;
-			iir_clear_all_coeffs(iir);
-			return;
+			count = 0;
+			break;
 		}
 	}
-	
-	poles = argc/2; //	integer division, floor
-	
-	//	Copy items in the input list to their proper locations.
-// 	iir->a0 = argv[0].a_w.w_float;	//	the first is always the same no matter the order
-// 	if (iir->inputOrder) {	//	aaabb
-// 		for (p=1; p<=poles && p<=IIR_MAX_POLES; p++) {
-// 			iir->a[p-1] = (double)argv[p].a_w.w_float;
-// 			iir->b[p-1] = (double)argv[poles+p].a_w.w_float;
-// 		}
-// 	}
-// 	else {					//	aabab
-// 		for (p=1; p<=poles && p<=IIR_MAX_POLES; p++) {
-// 			iir->a[p-1] = (double)argv[p*2-1].a_w.w_float;
-// 			iir->b[p-1] = (double)argv[p*2].a_w.w_float;
-// 		}
-// 	}
-	
-	iir->rampSteps = sys_getsr() * IIR_RAMP_SECONDS;
-	iir->rampCountdown = iir->rampSteps - 1;
-	
-	//	Copy items in the input list to their proper locations.
-	iir->aTarget0 = argv[0].a_w.w_float;	//	the first is always the same no matter the order
-	iir->aDiff0 = iir->a0 - iir->aTarget0;
-	if (iir->inputOrder) {	//	aaabb
-		for (p=1; p<=poles && p<=IIR_MAX_POLES; p++) {
-			iir->aTarget[p-1] = (double)argv[p].a_w.w_float;
-			iir->bTarget[p-1] = (double)argv[poles+p].a_w.w_float;
-			iir->aDiff[p-1] = iir->a[p-1] - iir->aTarget[p-1];
-			iir->bDiff[p-1] = iir->b[p-1] - iir->bTarget[p-1];
+
+	//	"aaabb" lists longer than IIR_MAX_POLES still index their b values from the middle
+	if (count > IIR_MAX_POLES*2+1 && !(list = (double *)sysmem_newptr(count * sizeof(double))))
+		return;
+
+	for(i=0; i<count; i++)
+		list[i] = (double)argv[i].a_w.w_float;
+
+	ATOMIC_INCREMENT(&iir->listsInFlight);
+	seq = ATOMIC_INCREMENT(&iir->listArrivals);
+
+	if (systhread_ismainthread())
+		systhread_mutex_lock(iir->listLock);
+	else if (systhread_mutex_trylock(iir->listLock)) {
+		//	the main thread is applying lists; this one joins the queue from there
+		if ((node = iir_list_new(seq, list, count))) {
+			do
+				node->next = iir->listsIncoming;
+			while (!IIR_CAS_PTR(node->next, node, &iir->listsIncoming));
 		}
+		else
+			object_error((t_object *)iir, "out of memory, list dropped");
+		ATOMIC_DECREMENT(&iir->listsInFlight);
+		qelem_set(iir->listQelem);
+		if (list != stackList)
+			sysmem_freeptr(list);
+		return;
 	}
-	else {					//	aabab
-		for (p=1; p<=poles && p<=IIR_MAX_POLES; p++) {
-			iir->aTarget[p-1] = (double)argv[p*2-1].a_w.w_float;
-			iir->bTarget[p-1] = (double)argv[p*2].a_w.w_float;
-			iir->aDiff[p-1] = iir->a[p-1] - iir->aTarget[p-1];
-			iir->bDiff[p-1] = iir->b[p-1] - iir->bTarget[p-1];
-		}
+
+	//	nothing ahead of it and room for it: apply it now
+	if (!iir->lists && iir->listsInFlight == 1 && iir_list_fits(iir, count)) {
+		redo = iir_list_apply(iir, list, count);
+		ATOMIC_DECREMENT(&iir->listsInFlight);
+		systhread_mutex_unlock(iir->listLock);
+		iir_list_redo(iir, redo);
 	}
-	
-	if ( poles != iir->poles ) {
-		if ( poles >= IIR_MAX_POLES ) {
-			iir->poles = IIR_MAX_POLES;
-		}
-		else {
-			if ( poles < iir->poles ) {
-				double* ap = iir->a + poles;
-				double* aEnd = iir->a + iir->poles;
-				double* bp = iir->b + poles;
-				while ( ap < aEnd ) {
-					*ap++ = 0.0;
-					*bp++ = 0.0;
-				}
-			}
-			
-			iir->poles = poles;
+	else {
+		if ((node = iir_list_new(seq, list, count)))
+			iir_list_insert(iir, node);
+		else
+			object_error((t_object *)iir, "out of memory, list dropped");
+		ATOMIC_DECREMENT(&iir->listsInFlight);
+		systhread_mutex_unlock(iir->listLock);
+
+		if (systhread_ismainthread())
+			iir_list_drain(iir);
+		else
+			qelem_set(iir->listQelem);
+	}
+
+	if (list != stackList)
+		sysmem_freeptr(list);
+}
+
+//	Main thread. Apply the queue in order, up to a list that has to wait for the state to move to
+//	a larger block or while a list numbered earlier has still to be queued. Whichever of those
+//	finishes last starts the queue again.
+void iir_list_drain(t_iir *iir)
+{
+	t_iirlist *node, *next;
+	long redo = 0;
+
+	systhread_mutex_lock(iir->listLock);
+
+	//	lists that could not be queued where they arrived; each goes in by its number
+	do
+		node = iir->listsIncoming;
+	while (node && !IIR_CAS_PTR(node, (t_iirlist *)NULL, &iir->listsIncoming));
+	for ( ; node; node = next) {
+		next = node->next;
+		iir_list_insert(iir, node);
+	}
+
+	while ((node = iir->lists) && !iir->listsInFlight && iir_grow_finish(iir)) {
+		if (!iir_list_fits(iir, node->count)) {
+			if (!iir_grow(iir, node->count/2))
+				object_error((t_object *)iir, "could not grow to %ld poles", node->count/2);
+			else if (iir->memNext)
+				break;
 		}
+
+		iir->lists = node->next;
+		redo |= iir_list_apply(iir, node->list, node->count);
+		sysmem_freeptr(node);
 	}
+
+	systhread_mutex_unlock(iir->listLock);
+
+	iir_list_redo(iir, redo);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void iir_clear_all_coeffs(t_iir *iir)
 {
-	//	"1.0" == pass data unchanged
-	//	"0.0" == silence
-	//	"0.1" == reduce overall by 20dB
-	iir->a0 = iir->aDiff0 = iir->aTarget0 = 0.0;
-	
-	for ( unsigned long p=0; p<IIR_MAX_POLES; p++ ) {
-		iir->a[p] = iir->b[p] = iir->aTarget[p] = iir->bTarget[p] = iir->aDiff[p] = iir->bDiff[p] = 0.0;
-	}
+	iir_state_clear_coeffs(&iir->state);
 }
@@ -0,0 +1,217 @@
+/**
+*	chebatlas - build an atlas of precomputed Chebyshev designs for the cheb external.
+*
+*	Every combination of the pole, ripple and cutoff grids is designed, low and high pass, with the
+*	same code cheb uses, at one sample rate. cheb maps the file and looks designs on the grid up
+*	instead of computing them. See cheb_atlas.h for the file layout.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../cheb_design.h"
+#include "../cheb_atlas.h"
+
+#define CHEBATLAS_MAX_GRID	100000
+
+//	ISO third octave centres
+static const char *defaultCutoffs =
+	"20,25,31.5,40,50,63,80,100,125,160,200,250,315,400,500,630,800,1000,1250,1600,"
+	"2000,2500,3150,4000,5000,6300,8000,10000,12500,16000,20000";
+static const char *defaultRipples = "0,0.5,1,2,5,10,20,29";
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: chebatlas [options]\n"
+		"  -s rate            sample rate (default 44100)\n"
+		"  -p min:max         even pole counts, 2-%d (default 2:%d)\n"
+		"  -r list            comma separated percentage ripples (default %s)\n"
+		"  -c list            comma separated cutoffs in Hz, or start:end:step (default ISO third octaves)\n"
+		"  -o file            output file (default cheb.atlas)\n",
+		MAX_CHEB_POLES, MAX_CHEB_POLES, defaultRipples);
+	exit(2);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+//	sort and drop repeats; returns the new count
+static long sort_unique(double *list, long count)
+{
+	long i, n = 0;
+
+	qsort(list, count, sizeof(double), compare_doubles);
+	for (i = 0; i < count; i++) {
+		if (!n || list[i] != list[n-1])
+			list[n++] = list[i];
+	}
+	return n;
+}
+
+//	comma separated values, or start:end:step; returns the count, or -1
+static long parse_grid(const char *arg, double *list)
+{
+	double start, end, step;
+	long count = 0;
+	char *copy, *tok, *save;
+
+	if (sscanf(arg, "%lf:%lf:%lf", &start, &end, &step) == 3) {
+		if (step <= 0.0 || end < start)
+			return -1;
+		for (long i = 0; start + i*step <= end && count < CHEBATLAS_MAX_GRID; i++)
+			list[count++] = start + i*step;
+		return count;
+	}
+
+	copy = strdup(arg);
+	for (tok = strtok_r(copy, ",", &save); tok && count < CHEBATLAS_MAX_GRID; tok = strtok_r(NULL, ",", &save)) {
+		char *end;
+		list[count++] = strtod(tok, &end);
+		if (end == tok || *end) {
+			free(copy);
+			return -1;
+		}
+	}
+	free(copy);
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+	const char *outPath = "cheb.atlas";
+	double sampleRate = 44100.0;
+	long minPoles = 2, maxPoles = MAX_CHEB_POLES;
+	double *ripple = malloc(CHEBATLAS_MAX_GRID * sizeof(double));
+	double *cutoff = malloc(CHEBATLAS_MAX_GRID * sizeof(double));
+	double *omegah, *a, *b, *record;
+	long rippleCount = -1, cutoffCount = -1, i, n, p, r, lh;
+	t_chebatlasheader h;
+	t_chebstages st;
+	FILE *out;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:p:r:c:o:")) != -1) {
+		switch (opt) {
+			case 's': sampleRate = atof(optarg); break;
+			case 'p':
+				if (sscanf(optarg, "%ld:%ld", &minPoles, &maxPoles) != 2)
+					usage();
+				break;
+			case 'r': rippleCount = parse_grid(optarg, ripple); break;
+			case 'c': cutoffCount = parse_grid(optarg, cutoff); break;
+			case 'o': outPath = optarg; break;
+			default: usage();
+		}
+	}
+	if (optind != argc || sampleRate <= 0.0 || minPoles < 2 || maxPoles > MAX_CHEB_POLES || minPoles > maxPoles)
+		usage();
+	minPoles = cheb_limit_poles(minPoles + 1);	//	round up to even
+	maxPoles = cheb_limit_poles(maxPoles);
+	if (rippleCount < 0)
+		rippleCount = parse_grid(defaultRipples, ripple);
+	if (cutoffCount < 0)
+		cutoffCount = parse_grid(defaultCutoffs, cutoff);
+
+	//	ripples as cheb limits them; cutoffs above Nyquist would all land on the same design
+	for (i = 0; i < rippleCount; i++)
+		ripple[i] = cheb_limit_ripple(ripple[i]);
+	for (i = n = 0; i < cutoffCount; i++) {
+		if (cutoff[i] > 0.0 && cutoff[i] <= sampleRate * 0.5)
+			cutoff[n++] = cutoff[i];
+	}
+	rippleCount = sort_unique(ripple, rippleCount);
+	cutoffCount = sort_unique(cutoff, n);
+	if (minPoles > maxPoles || rippleCount < 1 || cutoffCount < 1) {
+		fprintf(stderr, "chebatlas: empty grid\n");
+		return 1;
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.sampleRate	= sampleRate;
+	h.minPoles		= minPoles;
+	h.maxPoles		= maxPoles;
+	h.rippleCount	= rippleCount;
+	h.cutoffCount	= cutoffCount;
+	cheb_atlas_layout(&h);
+
+	omegah	= malloc(cutoffCount * sizeof(double));
+	a		= malloc(cutoffCount * (maxPoles+1) * sizeof(double));
+	b		= malloc(cutoffCount * (maxPoles+1) * sizeof(double));
+	record	= calloc(h.stride, sizeof(double));
+	if (!omegah || !a || !b || !record) {
+		fprintf(stderr, "chebatlas: out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < cutoffCount; i++)
+		omegah[i] = cheb_omegah(cutoff[i], sampleRate);
+
+	if (!(out = fopen(outPath, "wb"))) {
+		perror(outPath);
+		return 1;
+	}
+	fwrite(&h, sizeof(h), 1, out);
+	fwrite(ripple, sizeof(double), rippleCount, out);
+	fwrite(cutoff, sizeof(double), cutoffCount, out);
+	fwrite(omegah, sizeof(double), cutoffCount, out);
+
+	//	records in file order; every cutoff for one pole count and ripple is one sweep
+	cheb_stages_init(&st);
+	for (lh = 0; lh < 2; lh++) {
+		for (p = minPoles; p <= maxPoles; p += 2) {
+			for (r = 0; r < rippleCount; r++) {
+				if (p != st.poles)
+					cheb_stage_poles(&st, p);
+				cheb_stage_ripple(&st, ripple[r]);
+				cheb_stage_cutoff_sweep(&st, a, b, omegah, cutoffCount, lh);
+
+				for (n = 0; n < cutoffCount; n++) {
+					for (i = 0; i <= maxPoles; i++) {
+						record[i]				= i <= p ? a[n*(p+1) + i] : 0.0;
+						record[maxPoles+1 + i]	= i <= p ? b[n*(p+1) + i] : 0.0;
+					}
+					fwrite(record, sizeof(double), h.stride, out);
+				}
+			}
+		}
+	}
+
+	if (ferror(out) | fclose(out)) {
+		perror(outPath);
+		return 1;
+	}
+
+	printf("%s: %ld designs at %g Hz, %.1f kB\n", outPath,
+		2 * cheb_atlas_pole_count(&h) * rippleCount * cutoffCount, sampleRate, h.fileSize / 1024.0);
+
+	free(ripple);
+	free(cutoff);
+	free(omegah);
+	free(a);
+	free(b);
+	free(record);
+	return 0;
+}
@@ -0,0 +1,576 @@
+/**
+*	chebfilt - stream WAV or raw sample files through the same Chebyshev design and
+*	recursive filter kernel used by the cheb and iir~ externals.
+*
+*	Inputs are memory mapped, each channel of each file is filtered by its own job,
+*	and the jobs are spread across a pool of threads. Throughput is reported at the end.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../cheb_design.h"
+#include "../iir_kernel.h"
+
+#define CHEBFILT_BLOCK_FRAMES	65536
+
+//	sample formats; the value is bytes per sample
+typedef enum { FMT_S16 = 2, FMT_S24 = 3, FMT_S32 = 4, FMT_F32 = 0x104, FMT_F64 = 0x108 } t_format;
+#define FMT_BYTES(f)	((f) & 0xFF)
+#define FMT_IS_FLOAT(f)	((f) & 0x100)
+
+typedef struct
+{
+	const char *inPath;
+	char outPath[4096];
+	int inFd, outFd;
+	const unsigned char *inMap;		//	whole input file, read only
+	unsigned char *outMap;			//	whole output file
+	size_t inSize, outSize;
+	const unsigned char *inData;	//	first sample frame in the input
+	unsigned char *outData;			//	first sample frame in the output
+	long channels;
+	long frames;
+	double samplerate;
+	t_format inFormat, outFormat;
+	int isWav;
+} t_file;
+
+typedef struct
+{
+	t_file *file;
+	long channel;
+} t_job;
+
+//	settings shared by every job
+static double coeffs[IIR_MAX_POLES*2+1];
+static long coeffCount;
+static int coeffOrder;				//	0 = aabab, 1 = aaabb
+static int designFromArgs = 1;		//	design with cheb per file sample rate rather than use coeffs[] as given
+static long designPoles = 2;
+static double designRipple = 0.0;
+static double designCutoff = 1100.0;
+static int designHigh = 0;
+static long blockFrames = CHEBFILT_BLOCK_FRAMES;
+
+static t_job *jobs;
+static long jobCount;
+static long nextJob;
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: chebfilt [options] file...\n"
+		"  -t low|high        filter type (default low)\n"
+		"  -p poles           even number of poles, 2-%d (default 2)\n"
+		"  -r ripple          percentage ripple, 0-29 (default 0)\n"
+		"  -c cutoff          cutoff frequency in Hz (default 1100)\n"
+		"  -k file            use an iir~ coefficient list from file instead of designing one\n"
+		"  -a aabab|aaabb     order of the list given with -k (default aabab)\n"
+		"  -R rate:chans:fmt  inputs are raw samples; fmt is s16, s24, s32, f32 or f64\n"
+		"  -F                 write 64-bit float output\n"
+		"  -o dir             output directory (default is next to each input)\n"
+		"  -j threads         worker threads (default is the number of CPUs)\n"
+		"  -b frames          frames per block (default %d)\n"
+		"Output is written to <name>.filt.<ext>.\n",
+		MAX_CHEB_POLES, CHEBFILT_BLOCK_FRAMES);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int parse_format(const char *s, t_format *f)
+{
+	if (!strcmp(s, "s16")) *f = FMT_S16;
+	else if (!strcmp(s, "s24")) *f = FMT_S24;
+	else if (!strcmp(s, "s32")) *f = FMT_S32;
+	else if (!strcmp(s, "f32")) *f = FMT_F32;
+	else if (!strcmp(s, "f64")) *f = FMT_F64;
+	else return 0;
+	return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Coefficient list file: numbers separated by white space or commas, as in an iir~ list message.
+static int read_coeffs(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	char token[256];
+
+	if (!fp) {
+		fprintf(stderr, "chebfilt: %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	coeffCount = 0;
+	while (fscanf(fp, " %255[^ \t\r\n,;]%*[ \t\r\n,;]", token) == 1) {
+		char *end;
+		double v = strtod(token, &end);
+		if (*end) {
+			fprintf(stderr, "chebfilt: %s: \"%s\" is not a number\n", path, token);
+			fclose(fp);
+			return 0;
+		}
+		if (coeffCount == IIR_MAX_POLES*2+1) {
+			fprintf(stderr, "chebfilt: %s: more than %d coefficients\n", path, IIR_MAX_POLES*2+1);
+			fclose(fp);
+			return 0;
+		}
+		coeffs[coeffCount++] = v;
+	}
+	fclose(fp);
+
+	if (coeffCount < 1) {
+		fprintf(stderr, "chebfilt: %s: no coefficients\n", path);
+		return 0;
+	}
+	return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	WAV files are little endian, as is every host this tool is built for.
+static uint32_t le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void put16(unsigned char *p, uint16_t v)
+{
+	p[0] = v; p[1] = v >> 8;
+}
+
+static int parse_wav(t_file *f)
+{
+	const unsigned char *p = f->inMap, *end = f->inMap + f->inSize;
+	int haveFmt = 0;
+	uint16_t tag = 0, bits = 0;
+
+	if (f->inSize < 12 || memcmp(p, "RIFF", 4) || memcmp(p+8, "WAVE", 4))
+		return 0;
+
+	for (p += 12; p + 8 <= end; ) {
+		uint32_t size = le32(p+4);
+		const unsigned char *body = p + 8;
+
+		if (!memcmp(p, "fmt ", 4) && size >= 16) {
+			tag = le16(body);
+			f->channels = le16(body+2);
+			f->samplerate = le32(body+4);
+			bits = le16(body+14);
+			if (tag == 0xFFFE && size >= 26)	//	WAVE_FORMAT_EXTENSIBLE, sub format follows
+				tag = le16(body+24);
+			haveFmt = 1;
+		}
+		else if (!memcmp(p, "data", 4) && haveFmt) {
+			if (size > (size_t)(end - body))
+				size = end - body;
+			if (tag == 1 && bits == 16) f->inFormat = FMT_S16;
+			else if (tag == 1 && bits == 24) f->inFormat = FMT_S24;
+			else if (tag == 1 && bits == 32) f->inFormat = FMT_S32;
+			else if (tag == 3 && bits == 32) f->inFormat = FMT_F32;
+			else if (tag == 3 && bits == 64) f->inFormat = FMT_F64;
+			else {
+				fprintf(stderr, "chebfilt: %s: unsupported format %d, %d bits\n", f->inPath, tag, bits);
+				return 0;
+			}
+			if (f->channels < 1) return 0;
+			f->inData = body;
+			f->frames = size / (FMT_BYTES(f->inFormat) * f->channels);
+			return 1;
+		}
+		p = body + size + (size & 1);
+	}
+	return 0;
+}
+
+static void write_wav_header(t_file *f)
+{
+	unsigned char *h = f->outMap;
+	uint32_t bytes = FMT_BYTES(f->outFormat);
+	uint32_t dataSize = f->frames * f->channels * bytes;
+
+	memcpy(h, "RIFF", 4);
+	put32(h+4, 36 + dataSize);
+	memcpy(h+8, "WAVE", 4);
+	memcpy(h+12, "fmt ", 4);
+	put32(h+16, 16);
+	put16(h+20, FMT_IS_FLOAT(f->outFormat) ? 3 : 1);
+	put16(h+22, f->channels);
+	put32(h+24, (uint32_t)f->samplerate);
+	put32(h+28, (uint32_t)f->samplerate * f->channels * bytes);
+	put16(h+32, f->channels * bytes);
+	put16(h+34, bytes * 8);
+	memcpy(h+36, "data", 4);
+	put32(h+40, dataSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Read one channel of n frames into a double buffer, scaled to ±1.0 like MSP signals.
+static void load_channel(const t_file *f, long channel, long start, long n, double *dst)
+{
+	long stride = FMT_BYTES(f->inFormat) * f->channels;
+	const unsigned char *p = f->inData + start * stride + channel * FMT_BYTES(f->inFormat);
+
+	switch (f->inFormat) {
+		case FMT_S16:
+			for (long i = 0; i < n; i++, p += stride)
+				dst[i] = (int16_t)le16(p) / 32768.0;
+			break;
+		case FMT_S24:
+			for (long i = 0; i < n; i++, p += stride)
+				dst[i] = ((int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8) / 8388608.0;
+			break;
+		case FMT_S32:
+			for (long i = 0; i < n; i++, p += stride)
+				dst[i] = (int32_t)le32(p) / 2147483648.0;
+			break;
+		case FMT_F32:
+			for (long i = 0; i < n; i++, p += stride) {
+				float v;
+				memcpy(&v, p, sizeof(v));
+				dst[i] = v;
+			}
+			break;
+		case FMT_F64:
+			for (long i = 0; i < n; i++, p += stride)
+				memcpy(dst+i, p, sizeof(double));
+			break;
+	}
+}
+
+static long quantize(double v, double scale, long max)
+{
+	double q = v * scale;
+	q = q < 0.0 ? q - 0.5 : q + 0.5;
+	if (q > max) return max;
+	if (q < -max-1) return -max-1;
+	return (long)q;
+}
+
+static void store_channel(const t_file *f, long channel, long start, long n, const double *src)
+{
+	long stride = FMT_BYTES(f->outFormat) * f->channels;
+	unsigned char *p = f->outData + start * stride + channel * FMT_BYTES(f->outFormat);
+
+	switch (f->outFormat) {
+		case FMT_S16:
+			for (long i = 0; i < n; i++, p += stride)
+				put16(p, quantize(src[i], 32768.0, 32767));
+			break;
+		case FMT_S24:
+			for (long i = 0; i < n; i++, p += stride) {
+				long v = quantize(src[i], 8388608.0, 8388607);
+				p[0] = v; p[1] = v >> 8; p[2] = v >> 16;
+			}
+			break;
+		case FMT_S32:
+			for (long i = 0; i < n; i++, p += stride)
+				put32(p, quantize(src[i], 2147483648.0, 2147483647));
+			break;
+		case FMT_F32:
+			for (long i = 0; i < n; i++, p += stride) {
+				float v = src[i];
+				memcpy(p, &v, sizeof(v));
+			}
+			break;
+		case FMT_F64:
+			for (long i = 0; i < n; i++, p += stride)
+				memcpy(p, src+i, sizeof(double));
+			break;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Filter one channel of one file, starting the same way a new iir~ does when its first list
+//	arrives before audio is turned on: cleared state and a 10 ms ramp from zero.
+static void run_job(const t_job *job)
+{
+	const t_file *f = job->file;
+	double list[IIR_MAX_POLES*2+1];
+	long count = coeffCount;
+	double *mem = malloc(IIR_STATE_SIZE(IIR_MAX_POLES) * sizeof(double));
+	double *buf = malloc(blockFrames * sizeof(double));
+	t_iirstate state;
+
+	if (!mem || !buf) {
+		fprintf(stderr, "chebfilt: out of memory\n");
+		exit(1);
+	}
+
+	if (designFromArgs) {
+		double a[CHEB_WORK_SIZE(MAX_CHEB_POLES)], b[CHEB_WORK_SIZE(MAX_CHEB_POLES)];
+
+		cheb_design(a, b, designPoles, cheb_omegah(designCutoff, f->samplerate), designHigh, designRipple);
+
+		list[0] = a[0];
+		for (long p = 1; p <= designPoles; p++) {
+			list[2*p-1] = a[p];
+			list[2*p] = b[p];
+		}
+		count = designPoles*2+1;
+	}
+	else
+		memcpy(list, coeffs, count * sizeof(double));
+
+	iir_state_attach(&state, mem, IIR_MAX_POLES);
+	state.poles = 0;
+	iir_state_clear_coeffs(&state);
+	iir_state_clear_x(&state);
+	iir_state_clear_y(&state);
+	iir_state_set_coeffs(&state, list, count, designFromArgs ? 0 : coeffOrder, f->samplerate * IIR_RAMP_SECONDS);
+
+	for (long start = 0; start < f->frames; start += blockFrames) {
+		long n = f->frames - start < blockFrames ? f->frames - start : blockFrames;
+
+		load_channel(f, job->channel, start, n, buf);
+		for (long i = 0; i < n; i++)
+			buf[i] = iir_state_tick(&state, buf[i]);
+		store_channel(f, job->channel, start, n, buf);
+	}
+
+	free(buf);
+	free(mem);
+}
+
+static void *worker(void *arg)
+{
+	(void)arg;
+
+	for (;;) {
+		long j;
+
+		pthread_mutex_lock(&jobLock);
+		j = nextJob++;
+		pthread_mutex_unlock(&jobLock);
+
+		if (j >= jobCount)
+			return NULL;
+		run_job(jobs + j);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int open_file(t_file *f, const char *outDir, int raw, double rawRate, long rawChannels, t_format rawFormat, int float64Out)
+{
+	struct stat st;
+	const char *base, *dot;
+	size_t headerSize;
+
+	if ((f->inFd = open(f->inPath, O_RDONLY)) < 0 || fstat(f->inFd, &st) < 0) {
+		fprintf(stderr, "chebfilt: %s: %s\n", f->inPath, strerror(errno));
+		return 0;
+	}
+	f->inSize = st.st_size;
+	if (f->inSize == 0) {
+		fprintf(stderr, "chebfilt: %s: empty file\n", f->inPath);
+		return 0;
+	}
+	f->inMap = mmap(NULL, f->inSize, PROT_READ, MAP_PRIVATE, f->inFd, 0);
+	if (f->inMap == MAP_FAILED) {
+		fprintf(stderr, "chebfilt: %s: %s\n", f->inPath, strerror(errno));
+		return 0;
+	}
+	madvise((void *)f->inMap, f->inSize, MADV_SEQUENTIAL);
+
+	if (raw) {
+		f->isWav = 0;
+		f->samplerate = rawRate;
+		f->channels = rawChannels;
+		f->inFormat = rawFormat;
+		f->inData = f->inMap;
+		f->frames = f->inSize / (FMT_BYTES(rawFormat) * rawChannels);
+	}
+	else if (!(f->isWav = parse_wav(f))) {
+		fprintf(stderr, "chebfilt: %s: not a WAV file I can read (use -R for raw files)\n", f->inPath);
+		return 0;
+	}
+	f->outFormat = float64Out ? FMT_F64 : f->inFormat;
+
+	//	<dir>/<name>.filt.<ext>
+	base = strrchr(f->inPath, '/');
+	base = base ? base+1 : f->inPath;
+	dot = strrchr(base, '.');
+	if (outDir)
+		snprintf(f->outPath, sizeof(f->outPath), "%s/%.*s.filt%s", outDir,
+				 (int)(dot ? dot - base : (long)strlen(base)), base, dot ? dot : "");
+	else
+		snprintf(f->outPath, sizeof(f->outPath), "%.*s.filt%s",
+				 (int)(dot ? dot - f->inPath : (long)strlen(f->inPath)), f->inPath, dot ? dot : "");
+
+	headerSize = f->isWav ? 44 : 0;
+	f->outSize = headerSize + (size_t)f->frames * f->channels * FMT_BYTES(f->outFormat);
+	if ((f->outFd = open(f->outPath, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0
+		|| ftruncate(f->outFd, f->outSize) < 0) {
+		fprintf(stderr, "chebfilt: %s: %s\n", f->outPath, strerror(errno));
+		return 0;
+	}
+	if (f->outSize) {
+		f->outMap = mmap(NULL, f->outSize, PROT_READ | PROT_WRITE, MAP_SHARED, f->outFd, 0);
+		if (f->outMap == MAP_FAILED) {
+			fprintf(stderr, "chebfilt: %s: %s\n", f->outPath, strerror(errno));
+			return 0;
+		}
+	}
+	f->outData = f->outMap + headerSize;
+	if (f->isWav)
+		write_wav_header(f);
+	return 1;
+}
+
+static void close_file(t_file *f)
+{
+	if (f->outMap && f->outMap != MAP_FAILED)
+		munmap(f->outMap, f->outSize);
+	if (f->inMap && f->inMap != MAP_FAILED)
+		munmap((void *)f->inMap, f->inSize);
+	if (f->outFd >= 0)
+		close(f->outFd);
+	if (f->inFd >= 0)
+		close(f->inFd);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+	const char *outDir = NULL;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int raw = 0, float64Out = 0, opt;
+	double rawRate = 0.0;
+	long rawChannels = 0;
+	t_format rawFormat = FMT_F32;
+	char rawFmt[8];
+	t_file *files;
+	long fileCount, i, c;
+	double start, elapsed, audioSeconds = 0.0, samples = 0.0;
+	pthread_t *pool;
+	int failed = 0;
+
+	while ((opt = getopt(argc, argv, "t:p:r:c:k:a:R:Fo:j:b:")) != -1) {
+		switch (opt) {
+			case 't':
+				if (!strcmp(optarg, "high")) designHigh = 1;
+				else if (!strcmp(optarg, "low")) designHigh = 0;
+				else usage();
+				break;
+			case 'p': designPoles = cheb_limit_poles(atol(optarg)); break;
+			case 'r': designRipple = cheb_limit_ripple(atof(optarg)); break;
+			case 'c': designCutoff = atof(optarg); break;
+			case 'k':
+				if (!read_coeffs(optarg)) return 1;
+				designFromArgs = 0;
+				break;
+			case 'a':
+				if (!strcmp(optarg, "aaabb")) coeffOrder = 1;
+				else if (!strcmp(optarg, "aabab")) coeffOrder = 0;
+				else usage();
+				break;
+			case 'R':
+				if (sscanf(optarg, "%lf:%ld:%7s", &rawRate, &rawChannels, rawFmt) != 3
+					|| rawRate <= 0.0 || rawChannels < 1 || !parse_format(rawFmt, &rawFormat))
+					usage();
+				raw = 1;
+				break;
+			case 'F': float64Out = 1; break;
+			case 'o': outDir = optarg; break;
+			case 'j': threads = atol(optarg); break;
+			case 'b': blockFrames = atol(optarg); break;
+			default: usage();
+		}
+	}
+	if (optind >= argc || threads < 1 || blockFrames < 1 || (designFromArgs && designPoles < 2))
+		usage();
+
+	fileCount = argc - optind;
+	files = calloc(fileCount, sizeof(t_file));
+	for (i = 0; i < fileCount; i++) {
+		files[i].inPath = argv[optind+i];
+		files[i].inFd = files[i].outFd = -1;
+		if (!open_file(files+i, outDir, raw, rawRate, rawChannels, rawFormat, float64Out)) {
+			failed = 1;
+			files[i].channels = 0;
+		}
+	}
+
+	for (i = 0; i < fileCount; i++)
+		jobCount += files[i].channels;
+	jobs = malloc((jobCount ? jobCount : 1) * sizeof(t_job));
+	for (i = 0, jobCount = 0; i < fileCount; i++) {
+		for (c = 0; c < files[i].channels; c++) {
+			jobs[jobCount].file = files+i;
+			jobs[jobCount++].channel = c;
+		}
+		if (files[i].channels) {
+			audioSeconds += files[i].frames / files[i].samplerate;
+			samples += (double)files[i].frames * files[i].channels;
+		}
+	}
+
+	if (threads > jobCount)
+		threads = jobCount ? jobCount : 1;
+	pool = malloc(threads * sizeof(pthread_t));
+
+	start = now();
+	for (i = 0; i < threads; i++)
+		pthread_create(pool+i, NULL, worker, NULL);
+	for (i = 0; i < threads; i++)
+		pthread_join(pool[i], NULL);
+	elapsed = now() - start;
+
+	for (i = 0; i < fileCount; i++) {
+		if (files[i].channels)
+			printf("%s -> %s (%ld frames, %ld channels, %g Hz)\n", files[i].inPath, files[i].outPath,
+				   files[i].frames, files[i].channels, files[i].samplerate);
+		close_file(files+i);
+	}
+
+	if (elapsed <= 0.0)
+		elapsed = 1e-9;
+	printf("%ld files, %.0f samples in %.3f s on %ld threads: %.1f Msamples/s, %.1fx real time\n",
+		   fileCount, samples, elapsed, threads, samples / elapsed * 1e-6, audioSeconds / elapsed);
+
+	free(pool);
+	free(jobs);
+	free(files);
+	return failed;
+}
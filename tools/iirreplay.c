@@ -0,0 +1,372 @@
+/**
+*	iirreplay - run a trace recorded with "record" in iir~ through each filter kernel.
+*
+*	Every vector in the trace is filtered in order, with the coefficient lists and clears applied
+*	at the vectors they were stamped with, the way iir~ would have: ramps always run through the
+*	per sample kernel, the others only take over once a ramp is finished. Reports how long each
+*	vector took and how far each kernel's output is from iir_state_tick().
+*
+*	Replay starts from the state record, the direct form state the instance had at the first vector
+*	recorded. Not modelled: decimate and batch mode, the float output of 32-bit DSP, and the state
+*	of the sections when iir~ was running them (the sos kernel starts them from silence).
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../iir_kernel.h"
+#include "../iir_sos.h"
+#include "../iir_autotune.h"
+#include "../iir_trace.h"
+
+//	second order sections, as "sos 1" in iir~, after the direct form kernels
+#define KERNEL_SOS		IIR_KERNEL_COUNT
+#define KERNEL_COUNT	(IIR_KERNEL_COUNT + 1)
+
+static const char *kernelNames[KERNEL_COUNT] = { "tick", "block", "split", "unrolled", "transposed", "sos" };
+
+typedef struct
+{
+	const t_iirtraceheader *header;
+	const t_iirtracerecord **records;	//	in file order
+	long recordCount;
+	long blocks, lists, clears;
+	int hasState;
+	long samples;						//	in all blocks
+	long gaps, missing;					//	runs of blocks dropped while recording, and their samples
+} t_trace;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: iirreplay [options] trace\n"
+		"  -k list            comma separated kernels from tick,block,split,unrolled,\n"
+		"                     transposed,sos (default all)\n"
+		"  -n repeats         replays per kernel, each vector keeps its fastest time (default 5)\n");
+	exit(2);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static const double *record_data(const t_iirtracerecord *rec)
+{
+	return (const double *)(rec + 1);
+}
+
+//	Check the header and every record, and index them. Returns 0 with a message if the file is bad.
+static int index_trace(const char *path, const char *map, size_t size, t_trace *t)
+{
+	size_t pos = sizeof(t_iirtraceheader);
+	uint64_t expect = 0, last = 0;
+
+	memset(t, 0, sizeof(*t));
+	t->header = (const t_iirtraceheader *)map;
+	if (size < sizeof(t_iirtraceheader) || memcmp(t->header->magic, IIR_TRACE_MAGIC, 8)) {
+		fprintf(stderr, "iirreplay: %s: not a trace\n", path);
+		return 0;
+	}
+	if (t->header->byteOrder != IIR_TRACE_BYTE_ORDER || t->header->version != IIR_TRACE_VERSION) {
+		fprintf(stderr, "iirreplay: %s: trace version %u from a machine with another byte order or version\n",
+			path, t->header->version);
+		return 0;
+	}
+
+	t->records = malloc((size / sizeof(t_iirtracerecord) + 1) * sizeof(*t->records));
+	if (!t->records) {
+		fprintf(stderr, "iirreplay: out of memory\n");
+		return 0;
+	}
+
+	while (pos < size) {
+		const t_iirtracerecord *rec = (const t_iirtracerecord *)(map + pos);
+
+		if (size - pos < sizeof(*rec) || (size - pos - sizeof(*rec)) / sizeof(double) < rec->count) {
+			fprintf(stderr, "iirreplay: %s: truncated at byte %zu, replaying what came before\n", path, pos);
+			break;
+		}
+		if (rec->time < last) {
+			fprintf(stderr, "iirreplay: %s: record at byte %zu is out of time order\n", path, pos);
+			return 0;
+		}
+		last = rec->time;
+
+		switch (rec->type) {
+			case IIR_TRACE_BLOCK:
+				if (rec->time > expect) {
+					t->gaps++;
+					t->missing += rec->time - expect;
+				}
+				expect = rec->time + rec->count;
+				t->blocks++;
+				t->samples += rec->count;
+				break;
+			case IIR_TRACE_COEFFS:
+				t->lists++;
+				break;
+			case IIR_TRACE_CLEAR:
+				t->clears++;
+				break;
+			case IIR_TRACE_STATE:
+				if (t->hasState || rec->count < IIR_TRACE_STATE_SCALARS
+					|| !(record_data(rec)[IIR_TRACE_STATE_CAPACITY] >= 1.0)
+					|| record_data(rec)[IIR_TRACE_STATE_CAPACITY] > IIR_MAX_POLES
+					|| rec->count != IIR_TRACE_STATE_SCALARS + IIR_STATE_SIZE((long)record_data(rec)[IIR_TRACE_STATE_CAPACITY])) {
+					fprintf(stderr, "iirreplay: %s: bad state record at byte %zu\n", path, pos);
+					return 0;
+				}
+				t->hasState = 1;
+				break;
+			default:
+				fprintf(stderr, "iirreplay: %s: unknown record type %u at byte %zu\n", path, rec->type, pos);
+				return 0;
+		}
+
+		t->records[t->recordCount++] = rec;
+		pos += sizeof(*rec) + rec->count * sizeof(double);
+	}
+	return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Factor the target coefficients, as iir_sos_update() does in iir~.
+static void factor_targets(const t_iirstate *s, t_iirsos *sos)
+{
+	double a[IIR_MAX_POLES+1], b[IIR_MAX_POLES+1];
+	long p;
+
+	a[0] = s->aTarget0;
+	b[0] = 0.0;
+	for (p = 1; p <= s->poles; p++) {
+		a[p] = s->aTarget[p-1];
+		b[p] = s->bTarget[p-1];
+	}
+	iir_sos_factor(a, b, s->poles, sos);
+}
+
+//	One pass through the trace with one kernel, from the recorded state, or a new instance's before
+//	it. out gets every filtered sample, ns the time each vector took.
+static void replay(const t_trace *t, int kernel, double *out, double *ns)
+{
+	static double mem[IIR_STATE_SIZE(IIR_MAX_POLES)];
+	static t_iirsos sos, next, fade;
+	double xTail[IIR_MAX_POLES];
+	t_iirstate s;
+	int ready = 0, ran = 0, sections;
+	long fadeLeft = 0, fadeSteps = (long)(t->header->sampleRate * IIR_RAMP_SECONDS);
+	long r, b = 0, i;
+
+	//	as iir_new() leaves it
+	memset(mem, 0, sizeof(mem));
+	iir_state_attach(&s, mem, IIR_MAX_POLES);
+	s.poles = 0;
+	s.rampSteps = 1;
+	s.rampCountdown = -1;
+	iir_state_clear_coeffs(&s);
+	memset(&sos, 0, sizeof(sos));
+
+	for (r = 0; r < t->recordCount; r++) {
+		const t_iirtracerecord *rec = t->records[r];
+		long n = rec->count;
+
+		//	an empty list zeroes the direct form at once, as iir_list_apply() does; sections stay
+		if (rec->type == IIR_TRACE_COEFFS && !n) {
+			s.poles = 0;
+			s.rampCountdown = 0;
+			iir_state_clear_coeffs(&s);
+			continue;
+		}
+		if (rec->type == IIR_TRACE_COEFFS) {
+			iir_state_set_coeffs(&s, record_data(rec), n, rec->order, rec->rampSteps);
+			if (kernel == KERNEL_SOS) {
+				factor_targets(&s, &next);
+				ready = 1;
+			}
+			continue;
+		}
+		if (rec->type == IIR_TRACE_CLEAR) {
+			iir_state_clear_y(&s);
+			iir_sos_clear(&sos);
+			fadeLeft = 0;
+			continue;
+		}
+		if (rec->type == IIR_TRACE_STATE) {
+			iir_trace_get_state(rec, record_data(rec), &s);
+			iir_sos_clear(&sos);
+			if (kernel == KERNEL_SOS) {
+				factor_targets(&s, &next);
+				ready = 1;
+			}
+			continue;
+		}
+
+		memcpy(out, record_data(rec), n * sizeof(double));
+
+		double start = iir_autotune_now();
+		//	as iir_sos_begin() and iir_sos_run() do in iir~
+		if (kernel == KERNEL_SOS && ready) {
+			fadeLeft = iir_sos_take(&sos, &next, &fade) ? fadeSteps : 0;
+			ready = 0;
+		}
+		sections = kernel == KERNEL_SOS && sos.count;
+		if (ran && !sections) {
+			iir_state_settle(&s);
+			iir_state_clear_x(&s);
+			iir_state_clear_y(&s);
+		}
+		ran = sections;
+
+		if (sections) {
+			long tail = n < s.poles ? n : s.poles;
+			memcpy(xTail, out + n - tail, tail * sizeof(double));
+			fadeLeft = iir_sos_process_fade(&sos, &fade, out, n, fadeLeft, fadeSteps);
+			iir_state_history(&s, xTail, out + n - tail, tail);
+		}
+		else if (kernel != IIR_KERNEL_TICK && kernel != KERNEL_SOS && s.rampCountdown < 0)
+			iir_kernel_run(&s, kernel, out, out, n);
+		else {
+			for (i = 0; i < n; i++)
+				out[i] = iir_state_tick(&s, out[i]);
+		}
+		ns[b++] = (iir_autotune_now() - start) * 1e9;
+
+		out += n;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+	int run[KERNEL_COUNT] = { 1, 1, 1, 1, 1, 1 };
+	long repeats = 5, k, i, j;
+	double *reference, *out, *ns, *best, *sorted;
+	const char *path;
+	struct stat st;
+	char *map;
+	t_trace t;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "k:n:")) != -1) {
+		switch (opt) {
+			case 'k': {
+				char *copy = strdup(optarg), *tok, *save;
+				memset(run, 0, sizeof(run));
+				for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+					for (k = 0; k < KERNEL_COUNT && strcmp(tok, kernelNames[k]); k++)
+						;
+					if (k == KERNEL_COUNT)
+						usage();
+					run[k] = 1;
+				}
+				free(copy);
+				break;
+			}
+			case 'n': repeats = atol(optarg); break;
+			default: usage();
+		}
+	}
+	if (optind != argc - 1 || repeats < 1)
+		usage();
+	path = argv[optind];
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "iirreplay: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	map = mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "iirreplay: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	if (!index_trace(path, map, st.st_size, &t))
+		return 1;
+
+	printf("%s: %g Hz, %u-bit vectors of %u; %ld vectors, %ld samples, %ld lists, %ld clears\n", path,
+		t.header->sampleRate, t.header->precision, t.header->vectorSize, t.blocks, t.samples, t.lists, t.clears);
+	if (t.gaps)
+		printf("%ld gaps where vectors were dropped while recording, %ld samples missing; replayed as if contiguous\n", t.gaps, t.missing);
+	if (!t.blocks)
+		return 0;
+
+	reference	= malloc(t.samples * sizeof(double));
+	out			= malloc(t.samples * sizeof(double));
+	ns			= malloc(t.blocks * sizeof(double));
+	best		= malloc(t.blocks * sizeof(double));
+	sorted		= malloc(t.blocks * sizeof(double));
+	if (!reference || !out || !ns || !best || !sorted) {
+		fprintf(stderr, "iirreplay: out of memory\n");
+		return 1;
+	}
+
+	//	every kernel is compared against the per sample kernel
+	replay(&t, IIR_KERNEL_TICK, reference, ns);
+
+	printf("%-8s %10s %10s %10s %10s %10s %10s %10s %12s %12s\n", "kernel",
+		"min", "median", "p90", "p99", "max", "mean", "per sample", "max diff", "rms diff");
+	for (k = 0; k < KERNEL_COUNT; k++) {
+		double maxDiff = 0.0, sumSq = 0.0, mean = 0.0;
+
+		if (!run[k])
+			continue;
+
+		for (j = 0; j < repeats; j++) {
+			replay(&t, (int)k, out, ns);
+			for (i = 0; i < t.blocks; i++)
+				best[i] = j == 0 || ns[i] < best[i] ? ns[i] : best[i];
+		}
+
+		for (i = 0; i < t.samples; i++) {
+			double d = fabs(out[i] - reference[i]);
+			if (d > maxDiff || d != d)
+				maxDiff = d;
+			sumSq += d * d;
+		}
+		for (i = 0; i < t.blocks; i++)
+			mean += best[i];
+		mean /= t.blocks;
+
+		memcpy(sorted, best, t.blocks * sizeof(double));
+		qsort(sorted, t.blocks, sizeof(double), compare_doubles);
+		printf("%-8s %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f %10.3f %12.3e %12.3e\n", kernelNames[k],
+			sorted[0], sorted[t.blocks/2], sorted[t.blocks*90/100], sorted[t.blocks*99/100], sorted[t.blocks-1],
+			mean, mean * t.blocks / t.samples, maxDiff, sqrt(sumSq / t.samples));
+	}
+	printf("times in ns per vector, the fastest of %ld replays\n", repeats);
+
+	free(reference);
+	free(out);
+	free(ns);
+	free(best);
+	free(sorted);
+	free(t.records);
+	munmap(map, st.st_size ? st.st_size : 1);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,243 @@
+/**
+*	ratecheck - measure the alias and image rejection of the iir~ decimator and interpolator, and
+*	what decimation saves.
+*
+*	For every factor, full rate tones that fold into the protected band (below 0.8 of the low rate
+*	Nyquist frequency) go through the decimator, and whatever comes out is an alias. Tones in that
+*	band go down and back up with nothing in between, and whatever is left once the tone itself is
+*	taken out is images and aliases; the tone has to come back at its own level. The delay there
+*	and back is taken from the phase of neighbouring tones. Every tone falls on a bin of the
+*	analysis length, so nothing leaks. Exits 1 if a measurement is out of bounds.
+*
+*	Then, for a few pole counts, the direct form is timed at the full rate and at each factor with
+*	the resampling around it, and the multiplies per full rate sample are counted for both. Timings
+*	are only printed, never checked.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../iir_kernel.h"
+#include "../iir_multirate.h"
+#include "../iir_autotune.h"
+
+#define RATECHECK_BAND			0.8		//	of the low rate Nyquist frequency
+#define RATECHECK_LOW_SAMPLES	2048	//	analysis length at the low rate
+#define RATECHECK_WARMUP		1024	//	low rate samples for the resampling filters to settle
+#define RATECHECK_TONES			64		//	per factor and test
+#define RATECHECK_REJECTION		75.0	//	dB, aliases and images
+#define RATECHECK_FLATNESS		1.0		//	dB, passband there and back
+
+#define RATECHECK_BENCH_SAMPLES	(1L << 20)	//	full rate samples per timing
+#define RATECHECK_BENCH_RUNS	5			//	best of
+
+#define RATECHECK_PI			3.14159265358979323846
+
+static t_iirmultirate mr;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	dB of the largest low rate output of the decimator for a unit tone at bin of length samples.
+static double alias_level(long factor, long bin, long length)
+{
+	double low, sum = 0.0;
+	long n, count = 0, warmup = RATECHECK_WARMUP * factor;
+
+	iir_multirate_init(&mr, factor);
+	for ( n=0; n<warmup+length; n++ ) {
+		if ( iir_multirate_down(&mr, cos(2.0*RATECHECK_PI*bin*n/length), &low) && n >= warmup ) {
+			sum += low*low;
+			count++;
+		}
+		iir_multirate_push(&mr, 0.0);
+		iir_multirate_up(&mr);
+	}
+	return 10.0 * log10(2.0 * sum / count + 1e-300);
+}
+
+//	Down and straight back up. *gain is the dB level of the tone that comes back, *residue of the
+//	rest, relative to the tone that went in, and *phase how far the tone has turned.
+static void round_trip(long factor, long bin, long length, double *gain, double *residue, double *phase)
+{
+	static double out[RATECHECK_LOW_SAMPLES * IIR_MULTIRATE_MAX_FACTOR];
+	double low, c = 0.0, s = 0.0, total = 0.0, w;
+	long n, warmup = RATECHECK_WARMUP * factor;
+
+	iir_multirate_init(&mr, factor);
+	for ( n=0; n<warmup+length; n++ ) {
+		if ( iir_multirate_down(&mr, cos(2.0*RATECHECK_PI*bin*n/length), &low) )
+			iir_multirate_push(&mr, low);
+		w = iir_multirate_up(&mr);
+		if ( n >= warmup )
+			out[n-warmup] = w;
+	}
+
+	//	the tone is the projection onto its own bin; the delay only turns its phase
+	for ( n=0; n<length; n++ ) {
+		c += out[n] * cos(2.0*RATECHECK_PI*bin*(n+warmup)/length);
+		s += out[n] * sin(2.0*RATECHECK_PI*bin*(n+warmup)/length);
+		total += out[n] * out[n];
+	}
+	c *= 2.0 / length;
+	s *= 2.0 / length;
+	*gain = 10.0 * log10(c*c + s*s);
+	*residue = 10.0 * log10(fabs(2.0 * total / length - (c*c + s*s)) + 1e-300);
+	*phase = atan2(s, c);
+}
+
+//	Full rate samples of delay at bin, from the turn between it and the next bin.
+static double group_delay(long factor, long bin, long length)
+{
+	double gain, residue, p0, p1, turn;
+
+	round_trip(factor, bin, length, &gain, &residue, &p0);
+	round_trip(factor, bin+1, length, &gain, &residue, &p1);
+	turn = p1 - p0;
+	while ( turn < 0.0 )
+		turn += 2.0*RATECHECK_PI;
+	return turn * length / (2.0*RATECHECK_PI);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	Multiplies per full rate sample for the resampling at factor, both ways: a stage s from the full
+//	rate runs each of its sections once per pair of its input samples going down, and once per
+//	pair of its output samples coming up.
+static double resample_multiplies(long factor)
+{
+	double m = 0.0;
+	long s;
+
+	iir_multirate_init(&mr, factor);
+	for ( s=0; s<mr.stages; s++ )
+		m += 2.0 * mr.stage[s].sections / (double)(2L << s);
+	return m;
+}
+
+//	Stable coefficients for poles, "aabab" order, that keep the recursion busy on noise.
+static void bench_coeffs(double *list, long poles)
+{
+	long p;
+
+	list[0] = 0.5;
+	for ( p=0; p<poles; p++ ) {
+		list[1 + 2*p] = 0.1 / (p + 1);
+		list[2 + 2*p] = 0.3 / (poles * (p + 1));
+	}
+}
+
+//	Best time, in ns per full rate sample, for the direct form at 1/factor of the rate with the
+//	resampling around it; factor 1 is the direct form on its own.
+static double bench(long poles, long factor, const double *in)
+{
+	static double mem[IIR_STATE_SIZE(IIR_MAX_POLES)];
+	double list[2*IIR_MAX_POLES+1], best = 1e30, start, low, sink = 0.0;
+	t_iirstate s;
+	long r, n;
+
+	bench_coeffs(list, poles);
+	for ( r=0; r<RATECHECK_BENCH_RUNS; r++ ) {
+		memset(mem, 0, sizeof(mem));
+		iir_state_attach(&s, mem, IIR_MAX_POLES);
+		s.poles = 0;
+		s.rampCountdown = -1;
+		iir_state_set_coeffs(&s, list, 2*poles+1, 0, 1);
+		iir_state_tick(&s, 0.0);			//	ends the one step ramp
+		iir_multirate_init(&mr, factor);
+
+		start = iir_autotune_now();
+		if ( factor == 1 ) {
+			for ( n=0; n<RATECHECK_BENCH_SAMPLES; n++ )
+				sink += iir_state_tick(&s, in[n]);
+		}
+		else {
+			for ( n=0; n<RATECHECK_BENCH_SAMPLES; n++ ) {
+				if ( iir_multirate_down(&mr, in[n], &low) )
+					iir_multirate_push(&mr, iir_state_tick(&s, low));
+				sink += iir_multirate_up(&mr);
+			}
+		}
+		best = fmin(best, (iir_autotune_now() - start) * 1e9 / RATECHECK_BENCH_SAMPLES);
+	}
+	if ( sink == 12345.0 )
+		printf(" ");						//	keeps the loops from being optimised away
+	return best;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int main(void)
+{
+	static const long benchPoles[] = { 4, 10, 20, 40 };
+	double level, worstAlias, worstResidue, worstGain, gain, residue, phase, delay, maxDelay, direct;
+	double *in;
+	long factor, length, lowBin, bandBin, bin, t, p, failed = 0;
+
+	for ( factor=2; factor<=IIR_MULTIRATE_MAX_FACTOR; factor*=2 ) {
+		length = RATECHECK_LOW_SAMPLES * factor;
+		bandBin = (long)(RATECHECK_BAND * 0.5 * RATECHECK_LOW_SAMPLES);	//	edge of the band, in bins of length
+		worstAlias = worstResidue = -1000.0;
+		worstGain = 0.0;
+
+		//	full rate tones from the lowest that folds into the band up to the full rate Nyquist
+		lowBin = RATECHECK_LOW_SAMPLES - bandBin;
+		for ( t=0; t<RATECHECK_TONES; t++ ) {
+			bin = lowBin + t * (length/2 - lowBin) / (RATECHECK_TONES - 1);
+			level = alias_level(factor, bin, length);
+			worstAlias = fmax(worstAlias, level);
+		}
+
+		maxDelay = 0.0;
+		for ( t=0; t<RATECHECK_TONES; t++ ) {
+			bin = 1 + t * (bandBin - 2) / (RATECHECK_TONES - 1);
+			round_trip(factor, bin, length, &gain, &residue, &phase);
+			worstResidue = fmax(worstResidue, residue);
+			if ( fabs(gain) > fabs(worstGain) )
+				worstGain = gain;
+			maxDelay = fmax(maxDelay, group_delay(factor, bin, length));
+		}
+		delay = group_delay(factor, 1, length);
+
+		printf("factor %2ld: aliases %6.1f dB, images and aliases %6.1f dB, passband %+.3f dB, delay %.1f samples at DC, %.1f at most\n",
+			factor, worstAlias, worstResidue, worstGain, delay, maxDelay);
+		if ( worstAlias > -RATECHECK_REJECTION || worstResidue > -RATECHECK_REJECTION
+			|| fabs(worstGain) > RATECHECK_FLATNESS ) {
+			printf("FAIL factor %ld\n", factor);
+			failed++;
+		}
+	}
+
+	//	what decimation saves, against the direct form at the full rate
+	if ( !(in = (double *)malloc(RATECHECK_BENCH_SAMPLES * sizeof(double))) )
+		return 1;
+	srand(1);
+	for ( t=0; t<RATECHECK_BENCH_SAMPLES; t++ )
+		in[t] = rand() / (double)RAND_MAX - 0.5;
+
+	printf("\nper full rate sample: multiplies, and ns for the direct form with the resampling\n");
+	for ( p=0; p<(long)(sizeof(benchPoles)/sizeof(benchPoles[0])); p++ ) {
+		direct = bench(benchPoles[p], 1, in);
+		printf("%2ld poles: full rate %5.1f, %6.2f ns", benchPoles[p], 2.0*benchPoles[p] + 1.0, direct);
+		for ( factor=2; factor<=IIR_MULTIRATE_MAX_FACTOR; factor*=2 ) {
+			double ns = bench(benchPoles[p], factor, in);
+			printf(" | /%ld %5.1f, %6.2f ns (%+.0f%%)", factor,
+				resample_multiplies(factor) + (2.0*benchPoles[p] + 1.0) / factor, ns, 100.0 * (ns - direct) / direct);
+		}
+		printf("\n");
+	}
+	free(in);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+/**
+*	soscheck - factor a grid of cheb designs into second order sections and check them.
+*
+*	Every list whose direct form is stable has to factor, into sections that are each stable and
+*	whose cascade has the impulse response of the direct form. A list with a pole on or outside the
+*	unit circle (high orders at low cutoffs lose their poles to rounding in the coefficients) has to
+*	be refused. Stability of a list is decided by the Schur-Cohn step-down recursion, independently
+*	of the root finding. Exits 1 if any design fails.
+*
+*	Copyright 2004 Reid A. Woodbury Jr.
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*	   http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../cheb_design.h"
+#include "../iir_sos.h"
+
+#define SOSCHECK_RATE		44100.0
+#define SOSCHECK_SAMPLES	8192
+#define SOSCHECK_TOLERANCE	1e-9		//	impulse response error, relative to its peak
+
+static const double cutoffs[] = { 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 15000, 20000 };
+static const double ripples[] = { 0, 0.5, 5, 29 };
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//	True when every root of 1 - b1 z^-1 - ... - bP z^-P is inside the unit circle.
+static int list_stable(const double *b, long poles)
+{
+	long double c[MAX_CHEB_POLES+1], t[MAX_CHEB_POLES+1], k;
+	long i, m;
+
+	c[0] = 1.0L;
+	for ( i=1; i<=poles; i++ )
+		c[i] = -b[i];
+	for ( m=poles; m>=1; m-- ) {
+		k = c[m] / c[0];
+		if ( fabsl(k) >= 1.0L )
+			return 0;
+		for ( i=0; i<=m; i++ )
+			t[i] = c[i] - k * c[m-i];
+		for ( i=0; i<m; i++ )
+			c[i] = t[i];
+	}
+	return 1;
+}
+
+static int sections_stable(const t_iirsos *sos)
+{
+	long k;
+
+	for ( k=0; k<sos->count; k++ ) {
+		if ( fabs(sos->b2[k]) >= 1.0 || fabs(sos->b1[k]) >= 1.0 - sos->b2[k] )
+			return 0;
+	}
+	return 1;
+}
+
+//	Largest difference between the impulse responses of the cascade and of the direct form, the
+//	latter in double-double (long double loses too much to these lists), relative to its peak. The
+//	direct form has the exact (1 + z^-1)^P or (1 - z^-1)^P numerator of the design, not the list's
+//	rounding of it; with the poles this close to the zeros the difference shows.
+static double impulse_error(const double *a, const double *b, long poles, int lowHIGH, t_iirsos *sos)
+{
+	static double io[SOSCHECK_SAMPLES];
+	static t_iirsosdd y[SOSCHECK_SAMPLES];
+	t_iirsosdd acc;
+	double binomial = 1.0, peak = 0.0, err = 0.0, v;
+	long n, i;
+
+	for ( n=0; n<SOSCHECK_SAMPLES; n++ ) {
+		acc.hi = acc.lo = 0.0;
+		if ( n <= poles ) {
+			acc.hi = binomial;
+			acc = iir_sos_dd_mul(acc, a[0]);
+			binomial = (lowHIGH ? -binomial : binomial) * (poles - n) / (n + 1);
+		}
+		for ( i=1; i<=poles && i<=n; i++ )
+			acc = iir_sos_dd_add(acc, iir_sos_dd_mul(y[n-i], b[i]));
+		y[n] = acc;
+		io[n] = n ? 0.0 : 1.0;
+	}
+
+	iir_sos_clear(sos);
+	iir_sos_process(sos, io, SOSCHECK_SAMPLES);
+
+	for ( n=0; n<SOSCHECK_SAMPLES; n++ ) {
+		v = y[n].hi + y[n].lo;
+		peak = fmax(peak, fabs(v));
+		err = fmax(err, fabs(io[n] - v));
+	}
+	return err / peak;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int main(void)
+{
+	double a[CHEB_WORK_SIZE(MAX_CHEB_POLES)], b[CHEB_WORK_SIZE(MAX_CHEB_POLES)], err;
+	long poles, total = 0, factored = 0, unstable = 0, failed = 0;
+	int lowHIGH, stable, ok;
+	size_t c, r;
+	t_iirsos sos;
+
+	for ( lowHIGH=0; lowHIGH<2; lowHIGH++ ) {
+		for ( poles=2; poles<=MAX_CHEB_POLES; poles+=2 ) {
+			for ( c=0; c<sizeof(cutoffs)/sizeof(cutoffs[0]); c++ ) {
+				for ( r=0; r<sizeof(ripples)/sizeof(ripples[0]); r++ ) {
+					cheb_design(a, b, poles, cheb_omegah(cutoffs[c], SOSCHECK_RATE), lowHIGH, ripples[r]);
+					stable = list_stable(b, poles);
+					ok = iir_sos_factor(a, b, poles, &sos);
+					err = 0.0;
+					total++;
+
+					if ( ok ) {
+						factored++;
+						if ( stable && sections_stable(&sos) )
+							err = impulse_error(a, b, poles, lowHIGH, &sos);
+						ok = stable && sections_stable(&sos) && err <= SOSCHECK_TOLERANCE;
+					}
+					else {
+						unstable += !stable;
+						ok = !stable;
+					}
+
+					if ( !ok ) {
+						failed++;
+						printf("FAIL %s %2ld poles %5g Hz %4g%% ripple: list %s, %s",
+							lowHIGH ? "highpass" : "lowpass ", poles, cutoffs[c], ripples[r],
+							stable ? "stable" : "unstable", sos.count ? "factored" : "not factored");
+						if ( err > 0.0 )
+							printf(", impulse response off by %g", err);
+						printf("\n");
+					}
+				}
+			}
+		}
+	}
+
+	printf("soscheck: %ld designs, %ld factored, %ld refused with poles outside the unit circle, %ld failed\n",
+		total, factored, unstable, failed);
+	return failed ? 1 : 0;
+}